@@ -0,0 +1,243 @@
+#ifndef BAKED_MESH_H
+#define BAKED_MESH_H
+
+#include "mesh.h"
+#include "baked_texture.h"
+#include "cache_file.h"
+#include "mapped_file.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Baked meshes keep what the assimp import of a model file produced (interleaved Vertex arrays, indices
+// and the material texture references of every mesh) in a binary container under BAKED_MESH_DIR. Later
+// imports of the same file map the container instead of running assimp and its post-processing steps.
+//
+// Invalidation works like for baked textures: version, source path, importer flags and the layout of
+// Vertex must match, and the source must have the stored size and modification time, or failing that the
+// stored content hash.
+
+const char BAKED_MESH_MAGIC[4] = { 'B', 'M', 'S', 'H' };
+const uint32_t BAKED_MESH_VERSION = 1;
+const char *const BAKED_MESH_DIR = "cache/meshes";
+
+struct BakedMeshHeader {
+	char     magic[4];
+	uint32_t version;
+	uint32_t meshCount;
+	uint32_t textureCount;
+	uint32_t vertexSize;	// sizeof(Vertex) when written
+	uint32_t importFlags;
+	uint64_t sourceSize;
+	int64_t  sourceTime;
+	uint64_t sourceHash;
+	char     sourcePath[256];
+};
+
+struct BakedMeshRecord {
+	uint64_t vertexOffset;	// from the start of the container
+	uint64_t indexOffset;
+	uint32_t vertexCount;
+	uint32_t indexCount;
+	uint32_t firstTexture;	// into the texture table
+	uint32_t textureCount;
+};
+
+struct BakedMeshTexture {
+	char type[32];
+	char path[224];
+};
+
+// the CPU side of a mesh as it comes out of the importer, before any OpenGL object exists. Meshes read
+// from a baked container point into the mapping instead of filling vertices and indices, so the geometry
+// goes from the file to the GPU without a copy.
+struct MeshData {
+	vector<Vertex>       vertices;
+	vector<unsigned int> indices;
+	vector<Texture>      textures;	// ids are still 0, paths are relative to the model directory
+	const Vertex       *mappedVertices;	// into ModelData::geometry, NULL unless mapped
+	const unsigned int *mappedIndices;
+	size_t mappedVertexCount;
+	size_t mappedIndexCount;
+
+	MeshData() : mappedVertices(NULL), mappedIndices(NULL), mappedVertexCount(0), mappedIndexCount(0) {}
+
+	const Vertex* vertexData() const { return mappedVertices ? mappedVertices : vertices.data(); }
+	size_t vertexCount() const { return mappedVertices ? mappedVertexCount : vertices.size(); }
+	const unsigned int* indexData() const { return mappedIndices ? mappedIndices : indices.data(); }
+	size_t indexCount() const { return mappedIndices ? mappedIndexCount : indices.size(); }
+};
+
+// everything needed to build a Model. Producing it makes no OpenGL calls, so it can run on a worker thread
+// while the GL thread keeps rendering; the Model itself is then built on the GL thread.
+struct ModelData {
+	string directory;
+	vector<MeshData> meshes;
+	map<string, TextureImage> images;	// decoded material textures, keyed by Texture::path
+	MappedFile geometry;	// the baked container the meshes point into, if they came from one
+	bool compressed;	// whether the textures were requested block compressed
+
+	ModelData() : compressed(false) {}
+};
+
+inline string bakedMeshPath(const string &source)
+{
+	return cacheFilePath(BAKED_MESH_DIR, hashBytes(source.data(), source.size()), "bmsh");
+}
+
+// fills data.meshes from the cached container of source if it is still valid for it
+// ------------------------------------------------------------------------
+inline bool openBakedMesh(const string &source, unsigned int importFlags, ModelData &data)
+{
+	uint64_t size;
+	int64_t time;
+	if (!sourceFileInfo(source, size, time))
+		return false;
+
+	string cachePath = bakedMeshPath(source);
+	MappedFile file;
+	if (!file.open(cachePath) || file.size() < sizeof(BakedMeshHeader))
+		return false;
+
+	BakedMeshHeader header;
+	memcpy(&header, file.data(), sizeof(header));
+	if (memcmp(header.magic, BAKED_MESH_MAGIC, 4) != 0 || header.version != BAKED_MESH_VERSION || header.vertexSize != sizeof(Vertex)
+		|| header.importFlags != importFlags || strncmp(header.sourcePath, source.c_str(), sizeof(header.sourcePath)) != 0)
+		return false;
+	size_t tablesEnd = sizeof(header) + header.meshCount * sizeof(BakedMeshRecord) + header.textureCount * sizeof(BakedMeshTexture);
+	if (file.size() < tablesEnd)
+		return false;
+
+	if (header.sourceSize != size || header.sourceTime != time)
+	{
+		uint64_t hash;
+		if (header.sourceSize != size || !hashSourceFile(source, hash) || hash != header.sourceHash)
+			return false;
+		// same content, only touched: remember the new time (see openBakedTexture)
+		header.sourceTime = time;
+		file.close();
+		FILE *out = fopen(cachePath.c_str(), "r+b");
+		if (out)
+		{
+			fwrite(&header, sizeof(header), 1, out);
+			fclose(out);
+		}
+		if (!file.open(cachePath) || file.size() < tablesEnd)
+			return false;
+	}
+
+	const BakedMeshRecord *records = (const BakedMeshRecord*)(file.data() + sizeof(header));
+	const BakedMeshTexture *textures = (const BakedMeshTexture*)(records + header.meshCount);
+	vector<MeshData> meshes(header.meshCount);
+	for (unsigned int i = 0; i < header.meshCount; i++)
+	{
+		const BakedMeshRecord &record = records[i];
+		if (record.vertexOffset + (uint64_t)record.vertexCount * sizeof(Vertex) > file.size()
+			|| record.indexOffset + (uint64_t)record.indexCount * sizeof(unsigned int) > file.size()
+			|| (uint64_t)record.firstTexture + record.textureCount > header.textureCount)
+			return false;
+		meshes[i].mappedVertices = (const Vertex*)(file.data() + record.vertexOffset);
+		meshes[i].mappedVertexCount = record.vertexCount;
+		meshes[i].mappedIndices = (const unsigned int*)(file.data() + record.indexOffset);
+		meshes[i].mappedIndexCount = record.indexCount;
+		for (unsigned int j = 0; j < record.textureCount; j++)
+		{
+			const BakedMeshTexture &baked = textures[record.firstTexture + j];
+			Texture texture;
+			texture.id = 0;
+			texture.type = string(baked.type, strnlen(baked.type, sizeof(baked.type)));
+			texture.path = string(baked.path, strnlen(baked.path, sizeof(baked.path)));
+			meshes[i].textures.push_back(texture);
+		}
+	}
+	data.meshes.swap(meshes);
+	data.geometry = std::move(file);
+	return true;
+}
+
+// writes the container for the meshes imported from source
+// ------------------------------------------------------------------------
+inline bool writeBakedMesh(const string &source, unsigned int importFlags, const ModelData &data)
+{
+	BakedMeshHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, BAKED_MESH_MAGIC, 4);
+	header.version = BAKED_MESH_VERSION;
+	header.meshCount = (uint32_t)data.meshes.size();
+	header.vertexSize = sizeof(Vertex);
+	header.importFlags = importFlags;
+	strncpy(header.sourcePath, source.c_str(), sizeof(header.sourcePath) - 1);
+	if (!sourceFileInfo(source, header.sourceSize, header.sourceTime) || !hashSourceFile(source, header.sourceHash))
+		return false;
+
+	// tables first, then every mesh's vertices and indices, each block starting on a 16 byte boundary
+	vector<BakedMeshRecord> records(data.meshes.size());
+	vector<BakedMeshTexture> textures;
+	for (unsigned int i = 0; i < data.meshes.size(); i++)
+	{
+		records[i].firstTexture = (uint32_t)textures.size();
+		records[i].textureCount = (uint32_t)data.meshes[i].textures.size();
+		for (unsigned int j = 0; j < data.meshes[i].textures.size(); j++)
+		{
+			const Texture &texture = data.meshes[i].textures[j];
+			if (texture.type.size() >= sizeof(BakedMeshTexture::type) || texture.path.size() >= sizeof(BakedMeshTexture::path))
+				return false;  // wouldn't survive the round trip
+			BakedMeshTexture baked;
+			memset(&baked, 0, sizeof(baked));
+			memcpy(baked.type, texture.type.data(), texture.type.size());
+			memcpy(baked.path, texture.path.data(), texture.path.size());
+			textures.push_back(baked);
+		}
+	}
+	header.textureCount = (uint32_t)textures.size();
+	uint64_t offset = sizeof(header) + records.size() * sizeof(BakedMeshRecord) + textures.size() * sizeof(BakedMeshTexture);
+	for (unsigned int i = 0; i < data.meshes.size(); i++)
+	{
+		offset = (offset + 15) & ~(uint64_t)15;
+		records[i].vertexOffset = offset;
+		records[i].vertexCount = (uint32_t)data.meshes[i].vertices.size();
+		offset += data.meshes[i].vertices.size() * sizeof(Vertex);
+		offset = (offset + 15) & ~(uint64_t)15;
+		records[i].indexOffset = offset;
+		records[i].indexCount = (uint32_t)data.meshes[i].indices.size();
+		offset += data.meshes[i].indices.size() * sizeof(unsigned int);
+	}
+
+	// write to a temporary name first so a crash never leaves a truncated container behind
+	createCacheDir(BAKED_MESH_DIR);
+	string cachePath = bakedMeshPath(source);
+	string tempPath = cachePath + ".tmp";
+	FILE *out = fopen(tempPath.c_str(), "wb");
+	if (!out)
+		return false;
+	bool written = fwrite(&header, sizeof(header), 1, out) == 1
+		&& fwrite(records.data(), sizeof(BakedMeshRecord), records.size(), out) == records.size()
+		&& fwrite(textures.data(), sizeof(BakedMeshTexture), textures.size(), out) == textures.size();
+	static const char padding[16] = { 0 };
+	for (unsigned int i = 0; written && i < data.meshes.size(); i++)
+	{
+		const MeshData &mesh = data.meshes[i];
+		long position = ftell(out);
+		written = fwrite(padding, 1, (size_t)(records[i].vertexOffset - position), out) == records[i].vertexOffset - position
+			&& fwrite(mesh.vertices.data(), sizeof(Vertex), mesh.vertices.size(), out) == mesh.vertices.size();
+		position = ftell(out);
+		written = written && fwrite(padding, 1, (size_t)(records[i].indexOffset - position), out) == records[i].indexOffset - position
+			&& fwrite(mesh.indices.data(), sizeof(unsigned int), mesh.indices.size(), out) == mesh.indices.size();
+	}
+	fclose(out);
+	remove(cachePath.c_str());
+	if (!written || rename(tempPath.c_str(), cachePath.c_str()) != 0)
+	{
+		remove(tempPath.c_str());
+		cout << "Failed to write mesh cache for: " << source << endl;
+		return false;
+	}
+	return true;
+}
+#endif
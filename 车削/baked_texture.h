@@ -0,0 +1,402 @@
+#ifndef BAKED_TEXTURE_H
+#define BAKED_TEXTURE_H
+
+#include <glad/glad.h>
+
+#include "stb_image.h"
+#include "mapped_file.h"
+#include "block_compression.h"
+#include "cache_file.h"
+#include "gl_state.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Baked textures keep a decoded image together with its full mip chain in a binary container under
+// BAKED_TEXTURE_DIR. The first load decodes the PNG/BMP, builds the mips on the CPU and writes the
+// container; later loads map the container and upload every level directly, skipping both the inflate
+// and glGenerateMipmap.
+//
+// Invalidation: a container is used only if its version, source path and flip setting match and the
+// source file still has the size and modification time stored in the header. If only the time differs
+// (a fresh checkout, a copy) the source is hashed and compared with the stored content hash; on a match
+// the header is refreshed in place, otherwise the container is rebuilt.
+//
+// A container can also hold the image block compressed (see block_compression.h). Those are written
+// offline by the transcoder next to the plain ones, under their own key; loadTextureImage() uses them when
+// asked to and falls back to the plain container when there is none or it is out of date.
+
+const char BAKED_TEXTURE_MAGIC[4] = { 'B', 'T', 'E', 'X' };
+const uint32_t BAKED_TEXTURE_VERSION = 2;
+const char *const BAKED_TEXTURE_DIR = "cache/textures";
+
+struct BakedTextureHeader {
+	char     magic[4];
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t components;
+	uint32_t levels;
+	uint32_t flipped;
+	uint32_t format;	// compressed GL internal format, 0 for plain bytes
+	uint64_t sourceSize;
+	int64_t  sourceTime;
+	uint64_t sourceHash;
+	char     sourcePath[256];
+};
+
+struct BakedTextureLevel {
+	uint32_t width;
+	uint32_t height;
+	uint64_t offset;	// from the start of the container
+	uint64_t size;
+};
+
+// a decoded image and its mip chain, backed either by a mapped container or by freshly baked pixels
+struct TextureImage {
+	string path;
+	int width;
+	int height;
+	int components;
+	GLenum format;	// compressed internal format, 0 if levels hold components bytes per pixel
+	uint64_t sourceHash;	// content hash of the source file, 0 if unknown
+	vector<BakedTextureLevel> levels;
+	MappedFile file;
+	vector<unsigned char> pixels;
+
+	TextureImage() : width(0), height(0), components(0), format(0), sourceHash(0) {}
+
+	bool valid() const
+	{
+		return !levels.empty();
+	}
+
+	const unsigned char* levelData(unsigned int level) const
+	{
+		const unsigned char *base = file.isOpen() ? file.data() : pixels.data();
+		return base + levels[level].offset;
+	}
+};
+
+inline string bakedTexturePath(const string &source, bool flip, bool compressed = false)
+{
+	uint64_t key = hashBytes(source.data(), source.size());
+	key = hashBytes(flip ? "+flip" : "-flip", 5, key);
+	if (compressed)
+		key = hashBytes("+bc", 3, key);
+	return cacheFilePath(BAKED_TEXTURE_DIR, key, "btex");
+}
+
+inline void createBakedTextureDir()
+{
+	createCacheDir(BAKED_TEXTURE_DIR);
+}
+
+// maps the cached container of source if it is still valid for it
+// ------------------------------------------------------------------------
+inline bool openBakedTexture(const string &source, bool flip, TextureImage &image, bool compressed = false)
+{
+	uint64_t size;
+	int64_t time;
+	if (!sourceFileInfo(source, size, time))
+		return false;
+
+	string cachePath = bakedTexturePath(source, flip, compressed);
+	MappedFile file;
+	if (!file.open(cachePath) || file.size() < sizeof(BakedTextureHeader))
+		return false;
+
+	BakedTextureHeader header;
+	memcpy(&header, file.data(), sizeof(header));
+	if (memcmp(header.magic, BAKED_TEXTURE_MAGIC, 4) != 0 || header.version != BAKED_TEXTURE_VERSION
+		|| header.flipped != (flip ? 1u : 0u) || (header.format != 0) != compressed || strncmp(header.sourcePath, source.c_str(), sizeof(header.sourcePath)) != 0)
+		return false;
+	if (file.size() < sizeof(header) + header.levels * sizeof(BakedTextureLevel))
+		return false;
+
+	if (header.sourceSize != size || header.sourceTime != time)
+	{
+		uint64_t hash;
+		if (header.sourceSize != size || !hashSourceFile(source, hash) || hash != header.sourceHash)
+			return false;
+		// same content, only touched: remember the new time so the next launch skips the hash.
+		// the mapping has to go first, Windows won't open a mapped file for writing
+		header.sourceTime = time;
+		file.close();
+		FILE *out = fopen(cachePath.c_str(), "r+b");
+		if (out)
+		{
+			fwrite(&header, sizeof(header), 1, out);
+			fclose(out);
+		}
+		if (!file.open(cachePath) || file.size() < sizeof(header) + header.levels * sizeof(BakedTextureLevel))
+			return false;
+	}
+
+	image.path = source;
+	image.width = (int)header.width;
+	image.height = (int)header.height;
+	image.components = (int)header.components;
+	image.format = (GLenum)header.format;
+	image.sourceHash = header.sourceHash;
+	image.levels.resize(header.levels);
+	memcpy(image.levels.data(), file.data() + sizeof(header), header.levels * sizeof(BakedTextureLevel));
+	for (unsigned int i = 0; i < header.levels; i++)
+	{
+		if (image.levels[i].offset + image.levels[i].size > file.size())
+		{
+			image.levels.clear();
+			return false;
+		}
+	}
+	image.file = std::move(file);
+	return true;
+}
+
+// box filters one mip level into the next, odd edges are clamped
+inline void downsampleLevel(const unsigned char *src, int srcWidth, int srcHeight, int components, unsigned char *dst, int dstWidth, int dstHeight)
+{
+	for (int y = 0; y < dstHeight; y++)
+	{
+		int y0 = std::min(y * 2, srcHeight - 1), y1 = std::min(y * 2 + 1, srcHeight - 1);
+		for (int x = 0; x < dstWidth; x++)
+		{
+			int x0 = std::min(x * 2, srcWidth - 1), x1 = std::min(x * 2 + 1, srcWidth - 1);
+			for (int c = 0; c < components; c++)
+			{
+				int sum = src[(y0 * srcWidth + x0) * components + c] + src[(y0 * srcWidth + x1) * components + c]
+					+ src[(y1 * srcWidth + x0) * components + c] + src[(y1 * srcWidth + x1) * components + c];
+				dst[(y * dstWidth + x) * components + c] = (unsigned char)((sum + 2) / 4);
+			}
+		}
+	}
+}
+
+// lays out a full mip chain for a width x height image back to back, each level starting on a 16 byte
+// boundary, and allocates the pixels for it. Only level 0 needs filling in before generateMipChain().
+// with a compressed format the levels are sized for its blocks instead.
+inline void allocateMipChain(TextureImage &image, int width, int height, int components, GLenum format = 0)
+{
+	image.width = width;
+	image.height = height;
+	image.components = components;
+	image.format = format;
+	image.levels.clear();
+	uint64_t offset = 0;
+	int levelWidth = width, levelHeight = height;
+	for (;;)
+	{
+		BakedTextureLevel level;
+		level.width = (uint32_t)levelWidth;
+		level.height = (uint32_t)levelHeight;
+		level.offset = offset;
+		level.size = format != 0 ? compressedLevelBytes(format, levelWidth, levelHeight) : (uint64_t)levelWidth * levelHeight * components;
+		image.levels.push_back(level);
+		offset += (level.size + 15) & ~(uint64_t)15;
+		if (levelWidth == 1 && levelHeight == 1)
+			break;
+		levelWidth = std::max(levelWidth / 2, 1);
+		levelHeight = std::max(levelHeight / 2, 1);
+	}
+	image.pixels.assign((size_t)offset, 0);
+}
+
+// block compresses every level of a plain image into format
+// ------------------------------------------------------------------------
+inline TextureImage compressTextureImage(const TextureImage &source, GLenum format)
+{
+	TextureImage image;
+	allocateMipChain(image, source.width, source.height, source.components, format);
+	image.path = source.path;
+	image.sourceHash = source.sourceHash;
+	for (unsigned int i = 0; i < image.levels.size(); i++)
+		compressLevel(source.levelData(i), source.levels[i].width, source.levels[i].height, source.components, format, &image.pixels[(size_t)image.levels[i].offset]);
+	return image;
+}
+
+inline void generateMipChain(TextureImage &image)
+{
+	for (unsigned int i = 1; i < image.levels.size(); i++)
+	{
+		const BakedTextureLevel &src = image.levels[i - 1], &dst = image.levels[i];
+		downsampleLevel(&image.pixels[(size_t)src.offset], src.width, src.height, image.components, &image.pixels[(size_t)dst.offset], dst.width, dst.height);
+	}
+}
+
+// bilinearly resamples count channels starting at srcFirst into dst, starting at channel dstFirst.
+// channels the source doesn't have repeat its last one, so grey images fill all of rgb.
+inline void resampleChannels(const unsigned char *src, int srcWidth, int srcHeight, int srcComponents, int srcFirst,
+	unsigned char *dst, int dstWidth, int dstHeight, int dstComponents, int dstFirst, int count)
+{
+	for (int y = 0; y < dstHeight; y++)
+	{
+		float sy = std::max((y + 0.5f) * srcHeight / dstHeight - 0.5f, 0.0f);
+		int y0 = std::min((int)sy, srcHeight - 1), y1 = std::min(y0 + 1, srcHeight - 1);
+		float fy = sy - y0;
+		for (int x = 0; x < dstWidth; x++)
+		{
+			float sx = std::max((x + 0.5f) * srcWidth / dstWidth - 0.5f, 0.0f);
+			int x0 = std::min((int)sx, srcWidth - 1), x1 = std::min(x0 + 1, srcWidth - 1);
+			float fx = sx - x0;
+			for (int c = 0; c < count; c++)
+			{
+				int channel = std::min(srcFirst + c, srcComponents - 1);
+				float top = src[(y0 * srcWidth + x0) * srcComponents + channel] * (1.0f - fx) + src[(y0 * srcWidth + x1) * srcComponents + channel] * fx;
+				float bottom = src[(y1 * srcWidth + x0) * srcComponents + channel] * (1.0f - fx) + src[(y1 * srcWidth + x1) * srcComponents + channel] * fx;
+				dst[(y * dstWidth + x) * dstComponents + dstFirst + c] = (unsigned char)(top + (bottom - top) * fy + 0.5f);
+			}
+		}
+	}
+}
+
+// the smallest level of image that is still at least width x height, the best start for resampling
+inline unsigned int closestLevel(const TextureImage &image, int width, int height)
+{
+	unsigned int level = 0;
+	while (level + 1 < image.levels.size() && (int)image.levels[level + 1].width >= width && (int)image.levels[level + 1].height >= height)
+		level++;
+	return level;
+}
+
+// writes the container for an image of source (plain or compressed) so later loads can map it
+// ------------------------------------------------------------------------
+inline bool writeBakedTexture(const string &source, bool flip, const TextureImage &image)
+{
+	// levels are stored relative to the end of the level table in memory, the container adds the header
+	BakedTextureHeader header;
+	memset(&header, 0, sizeof(header));
+	uint64_t dataStart = sizeof(BakedTextureHeader) + image.levels.size() * sizeof(BakedTextureLevel);
+	dataStart = (dataStart + 15) & ~(uint64_t)15;
+	vector<BakedTextureLevel> table = image.levels;
+	for (unsigned int i = 0; i < table.size(); i++)
+		table[i].offset += dataStart;
+
+	memcpy(header.magic, BAKED_TEXTURE_MAGIC, 4);
+	header.version = BAKED_TEXTURE_VERSION;
+	header.width = (uint32_t)image.width;
+	header.height = (uint32_t)image.height;
+	header.components = (uint32_t)image.components;
+	header.levels = (uint32_t)table.size();
+	header.flipped = flip ? 1 : 0;
+	header.format = (uint32_t)image.format;
+	strncpy(header.sourcePath, source.c_str(), sizeof(header.sourcePath) - 1);
+	header.sourceHash = image.sourceHash;
+	if (!sourceFileInfo(source, header.sourceSize, header.sourceTime) || (header.sourceHash == 0 && !hashSourceFile(source, header.sourceHash)))
+		return false;
+
+	// write to a temporary name first so a crash never leaves a truncated container behind
+	createBakedTextureDir();
+	string cachePath = bakedTexturePath(source, flip, image.format != 0);
+	string tempPath = cachePath + ".tmp";
+	FILE *out = fopen(tempPath.c_str(), "wb");
+	if (!out)
+		return false;
+	bool written = fwrite(&header, sizeof(header), 1, out) == 1
+		&& fwrite(table.data(), sizeof(BakedTextureLevel), table.size(), out) == table.size();
+	static const char padding[16] = { 0 };
+	uint64_t tableEnd = sizeof(header) + table.size() * sizeof(BakedTextureLevel);
+	if (written && dataStart > tableEnd)
+		written = fwrite(padding, 1, (size_t)(dataStart - tableEnd), out) == dataStart - tableEnd;
+	if (written)
+		written = fwrite(image.pixels.data(), 1, image.pixels.size(), out) == image.pixels.size();
+	fclose(out);
+	remove(cachePath.c_str());
+	if (!written || rename(tempPath.c_str(), cachePath.c_str()) != 0)
+	{
+		remove(tempPath.c_str());
+		cout << "Failed to write texture cache for: " << source << endl;
+		return false;
+	}
+	return true;
+}
+
+// decodes source, builds its mip chain and writes the container for the next launch
+// ------------------------------------------------------------------------
+inline bool bakeTexture(const string &source, bool flip, TextureImage &image)
+{
+	int width, height, components;
+	// the flip flag is per thread, so workers baking different textures don't race on it
+	stbi_set_flip_vertically_on_load_thread(flip);
+	unsigned char *data = stbi_load(source.c_str(), &width, &height, &components, 0);
+	stbi_set_flip_vertically_on_load_thread(false);
+	if (!data)
+		return false;
+
+	allocateMipChain(image, width, height, components);
+	memcpy(image.pixels.data(), data, (size_t)image.levels[0].size);
+	stbi_image_free(data);
+	generateMipChain(image);
+	image.path = source;
+	hashSourceFile(source, image.sourceHash);
+	writeBakedTexture(source, flip, image);
+	return true;
+}
+
+// loads the image and its mips from the cache, baking the cache entry first if needed. With compressed
+// set the transcoded container is preferred, if there is an up to date one.
+// no OpenGL calls, so this may run on a worker thread.
+// ------------------------------------------------------------------------
+inline TextureImage loadTextureImage(const string &source, bool flip, bool compressed = false)
+{
+	TextureImage image;
+	if (compressed && openBakedTexture(source, flip, image, true))
+		return image;
+	if (!openBakedTexture(source, flip, image))
+		bakeTexture(source, flip, image);
+	image.path = source;
+	return image;
+}
+
+// creates a texture from a loaded image, uploading every baked mip level; must run on the GL thread
+// ------------------------------------------------------------------------
+inline unsigned int uploadTextureImage(const TextureImage &image)
+{
+	unsigned int textureID;
+	glGenTextures(1, &textureID);
+
+	if (image.valid())
+	{
+		GLenum format;
+		if (image.components == 1)
+			format = GL_RED;
+		else if (image.components == 2)
+			format = GL_RG;
+		else if (image.components == 3)
+			format = GL_RGB;
+		else
+			format = GL_RGBA;
+
+		glState().bindTexture(GL_TEXTURE_2D, textureID);
+		// the small mips of RGB images have rows that aren't multiples of 4 bytes
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for (unsigned int i = 0; i < image.levels.size(); i++)
+		{
+			const BakedTextureLevel &level = image.levels[i];
+			if (image.format != 0)
+				glCompressedTexImage2D(GL_TEXTURE_2D, i, image.format, level.width, level.height, 0, (GLsizei)level.size, image.levelData(i));
+			else
+				glTexImage2D(GL_TEXTURE_2D, i, format, level.width, level.height, 0, format, GL_UNSIGNED_BYTE, image.levelData(i));
+		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)image.levels.size() - 1);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	}
+	else
+	{
+		std::cout << "Texture failed to load at path: " << image.path << std::endl;
+	}
+
+	return textureID;
+}
+#endif
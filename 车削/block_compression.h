@@ -0,0 +1,237 @@
+#ifndef BLOCK_COMPRESSION_H
+#define BLOCK_COMPRESSION_H
+
+#include <glad/glad.h>
+
+#include "gl_extensions.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+using namespace std;
+
+// S3TC isn't core in 3.3, glad only has the core enums
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+// Encoders for the block compressed formats every desktop GPU samples natively: BC1 (DXT1, rgb),
+// BC3 (DXT5, rgba), BC4 (RGTC1, one channel) and BC5 (RGTC2, two channels). Each encodes a 4x4 block
+// of pixels into 8 or 16 bytes. The endpoints come from the block's bounding box, which is fast enough
+// to run at load time on a worker and close enough to a real fit for material textures.
+
+// the format a decoded image with this many components is compressed to
+inline GLenum compressedFormatFor(int components)
+{
+	if (components == 1)
+		return GL_COMPRESSED_RED_RGTC1;
+	else if (components == 2)
+		return GL_COMPRESSED_RG_RGTC2;
+	else if (components == 3)
+		return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+}
+
+inline unsigned int compressedBlockBytes(GLenum format)
+{
+	return format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT || format == GL_COMPRESSED_RED_RGTC1 ? 8 : 16;
+}
+
+inline uint64_t compressedLevelBytes(GLenum format, int width, int height)
+{
+	return (uint64_t)((width + 3) / 4) * ((height + 3) / 4) * compressedBlockBytes(format);
+}
+
+// true if the context can sample every format compressedFormatFor() returns. RGTC is core since 3.0,
+// S3TC needs the extension. Must run on the GL thread.
+// ------------------------------------------------------------------------
+inline bool compressedTexturesSupported()
+{
+	static int supported = -1;
+	if (supported < 0)
+		supported = hasGLExtension("GL_EXT_texture_compression_s3tc") ? 1 : 0;
+	return supported == 1;
+}
+
+inline uint16_t packRGB565(const unsigned char *rgb)
+{
+	return (uint16_t)(((rgb[0] * 31 + 127) / 255) << 11 | ((rgb[1] * 63 + 127) / 255) << 5 | ((rgb[2] * 31 + 127) / 255));
+}
+
+inline void unpackRGB565(uint16_t color, int *rgb)
+{
+	int r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+	rgb[0] = (r << 3) | (r >> 2);
+	rgb[1] = (g << 2) | (g >> 4);
+	rgb[2] = (b << 3) | (b >> 2);
+}
+
+// 16 rgba pixels -> 8 bytes of BC1 colour, always in four colour mode so it is valid inside BC3 as well
+// ------------------------------------------------------------------------
+inline void compressBC1Block(const unsigned char *rgba, unsigned char *block)
+{
+	// bounding box, then flip the axes that run against the widest one so the diagonal follows the colours
+	int low[3] = { 255, 255, 255 }, high[3] = { 0, 0, 0 }, mean[3] = { 0, 0, 0 };
+	for (int i = 0; i < 16; i++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			low[c] = std::min(low[c], (int)rgba[i * 4 + c]);
+			high[c] = std::max(high[c], (int)rgba[i * 4 + c]);
+			mean[c] += rgba[i * 4 + c];
+		}
+	}
+	int widest = 0;
+	for (int c = 1; c < 3; c++)
+		if (high[c] - low[c] > high[widest] - low[widest])
+			widest = c;
+	for (int c = 0; c < 3; c++)
+	{
+		if (c == widest)
+			continue;
+		int covariance = 0;
+		for (int i = 0; i < 16; i++)
+			covariance += (rgba[i * 4 + c] * 16 - mean[c]) * (rgba[i * 4 + widest] * 16 - mean[widest]);
+		if (covariance < 0)
+			std::swap(low[c], high[c]);
+	}
+	// pull the endpoints in a little, the extremes are usually outliers
+	unsigned char end0[3], end1[3];
+	for (int c = 0; c < 3; c++)
+	{
+		int inset = (high[c] - low[c]) / 16;
+		end0[c] = (unsigned char)(high[c] - inset);
+		end1[c] = (unsigned char)(low[c] + inset);
+	}
+
+	uint16_t color0 = packRGB565(end0), color1 = packRGB565(end1);
+	if (color0 < color1)
+		std::swap(color0, color1);
+	uint32_t indices = 0;
+	if (color0 != color1)
+	{
+		int palette[4][3];
+		unpackRGB565(color0, palette[0]);
+		unpackRGB565(color1, palette[1]);
+		for (int c = 0; c < 3; c++)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+		for (int i = 0; i < 16; i++)
+		{
+			int best = 0, bestError = INT32_MAX;
+			for (int p = 0; p < 4; p++)
+			{
+				int error = 0;
+				for (int c = 0; c < 3; c++)
+				{
+					int d = rgba[i * 4 + c] - palette[p][c];
+					error += d * d;
+				}
+				if (error < bestError)
+				{
+					best = p;
+					bestError = error;
+				}
+			}
+			indices |= (uint32_t)best << (2 * i);
+		}
+	}
+	block[0] = (unsigned char)(color0 & 0xff);
+	block[1] = (unsigned char)(color0 >> 8);
+	block[2] = (unsigned char)(color1 & 0xff);
+	block[3] = (unsigned char)(color1 >> 8);
+	for (int i = 0; i < 4; i++)
+		block[4 + i] = (unsigned char)(indices >> (8 * i));
+}
+
+// 16 values spaced stride bytes apart -> 8 bytes of BC4, also the alpha half of BC3 and each half of BC5
+// ------------------------------------------------------------------------
+inline void compressBC4Block(const unsigned char *values, int stride, unsigned char *block)
+{
+	int low = 255, high = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		low = std::min(low, (int)values[i * stride]);
+		high = std::max(high, (int)values[i * stride]);
+	}
+	uint64_t indices = 0;
+	if (high != low)
+	{
+		// eight value mode: 0 is high, 1 is low, 2..7 step from high to low
+		int palette[8] = { high, low };
+		for (int p = 2; p < 8; p++)
+			palette[p] = ((8 - p) * high + (p - 1) * low) / 7;
+		for (int i = 0; i < 16; i++)
+		{
+			int best = 0, bestError = 256;
+			for (int p = 0; p < 8; p++)
+			{
+				int error = abs(values[i * stride] - palette[p]);
+				if (error < bestError)
+				{
+					best = p;
+					bestError = error;
+				}
+			}
+			indices |= (uint64_t)best << (3 * i);
+		}
+	}
+	block[0] = (unsigned char)high;
+	block[1] = (unsigned char)low;
+	for (int i = 0; i < 6; i++)
+		block[2 + i] = (unsigned char)(indices >> (8 * i));
+}
+
+// compresses one level of components-per-pixel data into format; odd edges repeat their last pixel
+// ------------------------------------------------------------------------
+inline void compressLevel(const unsigned char *src, int width, int height, int components, GLenum format, unsigned char *dst)
+{
+	unsigned char rgba[16 * 4];
+	for (int by = 0; by < height; by += 4)
+	{
+		for (int bx = 0; bx < width; bx += 4)
+		{
+			for (int i = 0; i < 16; i++)
+			{
+				int x = std::min(bx + i % 4, width - 1), y = std::min(by + i / 4, height - 1);
+				const unsigned char *pixel = src + ((size_t)y * width + x) * components;
+				// grey fills rgb, missing alpha is opaque
+				for (int c = 0; c < 3; c++)
+					rgba[i * 4 + c] = pixel[std::min(c, components - 1)];
+				rgba[i * 4 + 3] = components == 4 ? pixel[3] : 255;
+				if (components == 2)
+				{
+					rgba[i * 4 + 1] = pixel[1];
+					rgba[i * 4 + 2] = 0;
+				}
+			}
+			if (format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT)
+			{
+				compressBC1Block(rgba, dst);
+			}
+			else if (format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT)
+			{
+				compressBC4Block(rgba + 3, 4, dst);
+				compressBC1Block(rgba, dst + 8);
+			}
+			else if (format == GL_COMPRESSED_RED_RGTC1)
+			{
+				compressBC4Block(rgba, 4, dst);
+			}
+			else
+			{
+				compressBC4Block(rgba, 4, dst);
+				compressBC4Block(rgba + 1, 4, dst + 8);
+			}
+			dst += compressedBlockBytes(format);
+		}
+	}
+}
+#endif
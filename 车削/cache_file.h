@@ -0,0 +1,79 @@
+#ifndef CACHE_FILE_H
+#define CACHE_FILE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+using namespace std;
+
+// Helpers shared by the on-disk caches under cache/ (baked textures, meshes): hashing for cache keys and
+// content checks, source file stamps for invalidation, and the directory layout.
+
+// FNV-1a, good enough to key cache files and detect content changes
+inline uint64_t hashBytes(const void *data, size_t size, uint64_t hash = 14695981039346656037ULL)
+{
+	const unsigned char *bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+inline bool sourceFileInfo(const string &path, uint64_t &size, int64_t &time)
+{
+#ifdef _WIN32
+	struct _stat64 info;
+	if (_stat64(path.c_str(), &info) != 0)
+		return false;
+#else
+	struct stat info;
+	if (stat(path.c_str(), &info) != 0)
+		return false;
+#endif
+	size = (uint64_t)info.st_size;
+	time = (int64_t)info.st_mtime;
+	return true;
+}
+
+inline bool hashSourceFile(const string &path, uint64_t &hash)
+{
+	ifstream file(path, ios::binary);
+	if (!file)
+		return false;
+	hash = 14695981039346656037ULL;
+	char buffer[1 << 16];
+	while (file)
+	{
+		file.read(buffer, sizeof(buffer));
+		hash = hashBytes(buffer, (size_t)file.gcount(), hash);
+	}
+	return true;
+}
+
+// creates cache/ and the given directory below it if they don't exist yet
+inline void createCacheDir(const char *directory)
+{
+#ifdef _WIN32
+	_mkdir("cache");
+	_mkdir(directory);
+#else
+	mkdir("cache", 0755);
+	mkdir(directory, 0755);
+#endif
+}
+
+// directory/<key as 16 hex digits>.<extension>
+inline string cacheFilePath(const char *directory, uint64_t key, const char *extension)
+{
+	char name[48];
+	snprintf(name, sizeof(name), "%016llx.%s", (unsigned long long)key, extension);
+	return string(directory) + "/" + name;
+}
+#endif
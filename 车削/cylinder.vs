@@ -1,8 +1,8 @@
 #version 330 core
-layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal;
+//ѹĶʽ(stock_vertex.h)
+layout (location = 0) in vec4 aPos;  //xyz:Χеλ(Ѳmodel),w:Ƿ(0Ϊ,1Ϊ)
+layout (location = 1) in vec2 aNormal;  //ķ
 layout (location = 2) in vec2 aTexCoords;
-layout (location = 3) in float aIsCut;  //Ƿ(0Ϊ,1Ϊ)
 
 
 out vec3 Normal;
@@ -10,19 +10,39 @@ out vec3 WorldPos;
 out vec2 TexCoords;
 out float isCut;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+//ÿλƵı任(std140,main.cppеDrawTransformһ),߾CPU
+layout (std140) uniform DrawTransform {
+    mat4 model;
+    mat3 normalMatrix;  //transpose(inverse(mat3(model)))
+};
+
+//ÿ֡͵ƹ(std140,main.cppеFrameDataһ)
+layout (std140) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+    vec4 viewPos;            // xyz
+    vec4 lightPositions[4];  // xyz
+    vec4 lightColors[4];     // rgb
+};
+
+//뻹ԭΪλ:°۵|x|+|y|>1Ĳ
+vec3 octDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
-	WorldPos=vec3(model*vec4(aPos,1.0));
+    gl_Position = projection * view * model * vec4(aPos.xyz, 1.0);
+	WorldPos=vec3(model*vec4(aPos.xyz,1.0));
 	TexCoords=aTexCoords;
-	isCut=aIsCut;
+	isCut=aPos.w;
 
 	//Ҫתϵ
-	Normal=mat3(transpose(inverse(model)))*aNormal; 
+	Normal=normalMatrix*octDecode(aNormal); 
     
 
 }
\ No newline at end of file
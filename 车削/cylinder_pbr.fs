@@ -1,4 +1,15 @@
 #version 330 core
+//忪ShaderVariantsڱǰע,ǵʱĬֵ
+#ifndef LIGHT_COUNT
+#define LIGHT_COUNT 4      //ѭĵԴ
+#endif
+#ifndef NORMAL_MAP
+#define NORMAL_MAP 1       //0:ֱö㷨,ͼ
+#endif
+#ifndef CUT_BLENDING
+#define CUT_BLENDING 1     //0:Բ廹ûбĲ,ֻδĲ
+#endif
+
 out vec4 FragColor;
 in vec2 TexCoords;
 in vec3 WorldPos;
@@ -6,24 +17,22 @@ in vec3 Normal;
 in float isCut;
 
 // material parameters
-uniform sampler2D albedoMap;
-uniform sampler2D normalMap;
-uniform sampler2D metallicMap;
-uniform sampler2D roughnessMap;
-uniform sampler2D aoMap;
-
-//Ĳ
-uniform sampler2D albedoMap1;
-uniform sampler2D normalMap1;
-uniform sampler2D metallicMap1;
-uniform sampler2D roughnessMap1;
-uniform sampler2D aoMap1;
-
-// lights
-uniform vec3 lightPositions[4];
-uniform vec3 lightColors[4];
-
-uniform vec3 viewPos;
+uniform sampler2DArray albedoMap;
+uniform sampler2DArray normalMap;
+uniform sampler2DArray ormMap;  // r: ao, g: roughness, b: metallic
+
+//δ(x)(y)ĲеĲ
+uniform vec2 materialLayers;
+
+// camera and lights
+//ÿ֡͵ƹ(std140,main.cppеFrameDataһ)
+layout (std140) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+    vec4 viewPos;            // xyz
+    vec4 lightPositions[4];  // xyz
+    vec4 lightColors[4];     // rgb
+};
 
 const float PI = 3.14159265359;
 // ----------------------------------------------------------------------------
@@ -31,9 +40,13 @@ const float PI = 3.14159265359;
 // Don't worry if you don't get what's going on; you generally want to do normal 
 // mapping the usual way for performance anways; I do plan make a note of this 
 // technique somewhere later in the normal mapping tutorial.
-vec3 getNormalFromMap()
+#if NORMAL_MAP
+vec3 getNormalFromMap(vec3 materialCoords)
 {
-    vec3 tangentNormal = texture(isCut==0.0f?normalMap:normalMap1, TexCoords).xyz * 2.0 - 1.0;
+    //ͼֻxy(ѹʱΪBC5),zɵλȻԭ
+    vec3 tangentNormal;
+    tangentNormal.xy = texture(normalMap, materialCoords).rg * 2.0 - 1.0;
+    tangentNormal.z = sqrt(max(1.0 - dot(tangentNormal.xy, tangentNormal.xy), 0.0));
 
     vec3 Q1  = dFdx(WorldPos);
     vec3 Q2  = dFdy(WorldPos);
@@ -47,6 +60,7 @@ vec3 getNormalFromMap()
 
     return normalize(TBN * tangentNormal);
 }
+#endif
 // ----------------------------------------------------------------------------
 float DistributionGGX(vec3 N, vec3 H, float roughness)
 {
@@ -90,13 +104,23 @@ vec3 fresnelSchlick(float cosTheta, vec3 F0)
 // ----------------------------------------------------------------------------
 void main()
 {		
-    vec3 albedo     = pow(texture(isCut==0.0f?albedoMap:albedoMap1, TexCoords).rgb, vec3(2.2));
-    float metallic  = texture(isCut==0?metallicMap:metallicMap1, TexCoords).r;
-    float roughness = texture(isCut==0.0f?roughnessMap:roughnessMap1, TexCoords).r;
-    float ao        = texture(aoMap, TexCoords).r;
-
-    vec3 N = getNormalFromMap();
-    vec3 V = normalize(viewPos - WorldPos);
+#if CUT_BLENDING
+    vec3 materialCoords = vec3(TexCoords, isCut == 0.0f ? materialLayers.x : materialLayers.y);
+#else
+    vec3 materialCoords = vec3(TexCoords, materialLayers.x);
+#endif
+    vec3 albedo     = pow(texture(albedoMap, materialCoords).rgb, vec3(2.2));
+    vec3 orm        = texture(ormMap, materialCoords).rgb;
+    float ao        = orm.r;
+    float roughness = orm.g;
+    float metallic  = orm.b;
+
+#if NORMAL_MAP
+    vec3 N = getNormalFromMap(materialCoords);
+#else
+    vec3 N = normalize(Normal);
+#endif
+    vec3 V = normalize(viewPos.xyz - WorldPos);
 
     // calculate reflectance at normal incidence; if dia-electric (like plastic) use F0 
     // of 0.04 and if it's a metal, use the albedo color as F0 (metallic workflow)    
@@ -105,14 +129,14 @@ void main()
 
     // reflectance equation
     vec3 Lo = vec3(0.0);
-    for(int i = 0; i < 4; ++i) 
+    for(int i = 0; i < LIGHT_COUNT; ++i) 
     {
         // calculate per-light radiance
-        vec3 L = normalize(lightPositions[i] - WorldPos);
+        vec3 L = normalize(lightPositions[i].xyz - WorldPos);
         vec3 H = normalize(V + L);
-        float distance = length(lightPositions[i] - WorldPos);
+        float distance = length(lightPositions[i].xyz - WorldPos);
         float attenuation = 1.0 / (distance * distance);
-        vec3 radiance = lightColors[i] * attenuation;
+        vec3 radiance = lightColors[i].rgb * attenuation;
 
         // Cook-Torrance BRDF
         float NDF = DistributionGGX(N, H, roughness);   
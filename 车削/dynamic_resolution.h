@@ -0,0 +1,153 @@
+#ifndef DYNAMIC_RESOLUTION_H
+#define DYNAMIC_RESOLUTION_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+using namespace std;
+
+// Renders the scene at a resolution that follows a frame time budget. begin() redirects drawing into an
+// offscreen target of the window's size, of which only the scaled rectangle is used, so changing the scale
+// never reallocates anything; end() stretches that rectangle over the window and leaves the default
+// framebuffer bound for overlays drawn at full resolution.
+//
+// The frame time is the CPU time from one begin() to the next, which includes the swap: software
+// rasterisers do their fragment work when the frame is flushed, so GL timer queries around the scene pass
+// miss it, while on a GPU bound frame the swap waits for the GPU. It is smoothed over a few frames.
+// Fragment cost grows with the pixel count, so the scale moves by the square root of budget over frame
+// time, in steps of SCALE_STEP, only when it is off by more than a step and at most every SETTLE_FRAMES
+// frames, giving the average time to follow. With vsync the budget has to be above the refresh interval.
+// GL thread only.
+class DynamicResolution
+{
+public:
+	static constexpr double SCALE_STEP = 0.05;
+	static const unsigned int SETTLE_FRAMES = 8;
+
+	// budget is the frame time aimed for, in seconds; the scale stays within minScale..1
+	explicit DynamicResolution(double budget, double minScale = 0.5)
+		: budget(budget), minScale(minScale), currentScale(1.0), width(0), height(0), active(false),
+		timed(false), averageFrame(0.0), framesSinceChange(0), frames(0), scaleTotal(0.0), lowestScale(1.0)
+	{
+		glGenFramebuffers(1, &fbo);
+		glGenRenderbuffers(1, &color);
+		glGenRenderbuffers(1, &depth);
+	}
+
+	~DynamicResolution()
+	{
+		glDeleteRenderbuffers(1, &color);
+		glDeleteRenderbuffers(1, &depth);
+		glDeleteFramebuffers(1, &fbo);
+	}
+
+	DynamicResolution(const DynamicResolution&) = delete;
+	DynamicResolution& operator=(const DynamicResolution&) = delete;
+
+	// starts the scene pass for a window framebuffer of windowWidth x windowHeight: binds the offscreen
+	// target and sets the viewport to the scaled size
+	// ------------------------------------------------------------------------
+	void begin(int windowWidth, int windowHeight)
+	{
+		active = windowWidth > 0 && windowHeight > 0;
+		if (!active)
+		{
+			timed = false;	// e.g. minimised
+			return;
+		}
+		if (windowWidth != width || windowHeight != height)
+			resize(windowWidth, windowHeight);
+		adapt();
+
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glViewport(0, 0, renderWidth(), renderHeight());
+	}
+
+	// ends the scene pass: upscales it onto the default framebuffer, whose depth is cleared so overlays can
+	// be drawn with the usual depth test
+	// ------------------------------------------------------------------------
+	void end()
+	{
+		if (!active)
+			return;
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		glBlitFramebuffer(0, 0, renderWidth(), renderHeight(), 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glViewport(0, 0, width, height);
+		glClear(GL_DEPTH_BUFFER_BIT);
+
+		frames++;
+		scaleTotal += currentScale;
+		lowestScale = std::min(lowestScale, currentScale);
+	}
+
+	// the time until the next begin() is no frame time, e.g. because the loop waited for input
+	void restartTiming() { timed = false; }
+
+	double scale() const { return currentScale; }
+	int renderWidth() const { return std::max(1, (int)(width * currentScale + 0.5)); }
+	int renderHeight() const { return std::max(1, (int)(height * currentScale + 0.5)); }
+
+	// statistics
+	// ------------------------------------------------------------------------
+	double averageScale() const { return frames > 0 ? scaleTotal / frames : 1.0; }
+	double minimumScale() const { return lowestScale; }
+
+private:
+	GLuint fbo, color, depth;
+	double budget, minScale, currentScale;
+	int width, height;
+	bool active;
+
+	bool timed;	// lastBegin starts a frame that counts
+	chrono::steady_clock::time_point lastBegin;
+	double averageFrame;	// seconds, 0 until measured
+	unsigned int framesSinceChange;
+
+	uint64_t frames;
+	double scaleTotal, lowestScale;
+
+	void resize(int windowWidth, int windowHeight)
+	{
+		width = windowWidth;
+		height = windowHeight;
+		glBindRenderbuffer(GL_RENDERBUFFER, color);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, depth);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	// measures the frame that just ended and steers the scale by the average
+	// ------------------------------------------------------------------------
+	void adapt()
+	{
+		chrono::steady_clock::time_point now = chrono::steady_clock::now();
+		bool measured = timed;
+		double seconds = chrono::duration<double>(now - lastBegin).count();
+		lastBegin = now;
+		timed = true;
+		if (!measured || seconds <= 0.0)
+			return;
+		averageFrame = averageFrame > 0.0 ? averageFrame * 0.8 + seconds * 0.2 : seconds;
+		if (++framesSinceChange < SETTLE_FRAMES)
+			return;
+
+		double wanted = currentScale * sqrt(budget / averageFrame);
+		wanted = std::max(minScale, std::min(1.0, wanted));
+		if (fabs(wanted - currentScale) > SCALE_STEP)
+		{
+			currentScale = std::max(minScale, std::min(1.0, floor(wanted / SCALE_STEP + 0.5) * SCALE_STEP));
+			framesSinceChange = 0;
+		}
+	}
+};
+#endif
@@ -0,0 +1,106 @@
+#ifndef GL_EXTENSIONS_H
+#define GL_EXTENSIONS_H
+
+#include <glad/glad.h>
+
+#include <cstring>
+using namespace std;
+
+// glad is generated for plain 3.3 core, so the newer entry points the renderer uses when the driver has
+// them are loaded here. loadGLExtensions() runs once after glad on the GL thread; afterwards glExtensions()
+// says what is available, and a function pointer is only non-NULL if its feature is.
+
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+struct GLExtensions {
+	// ARB_get_program_binary (core in 4.1), with at least one binary format
+	bool programBinary;
+	void (APIENTRYP GetProgramBinary)(GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, void *binary);
+	void (APIENTRYP ProgramBinary)(GLuint program, GLenum binaryFormat, const void *binary, GLsizei length);
+	void (APIENTRYP ProgramParameteri)(GLuint program, GLenum pname, GLint value);
+	// KHR_parallel_shader_compile (or the ARB original): compiles and links run on driver threads and
+	// GL_COMPLETION_STATUS_KHR can be polled without blocking
+	bool parallelShaderCompile;
+	void (APIENTRYP MaxShaderCompilerThreads)(GLuint count);
+	// ARB_buffer_storage (core in 4.4): immutable buffers that can stay mapped while the GPU reads them
+	bool bufferStorage;
+	void (APIENTRYP BufferStorage)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+};
+
+inline GLExtensions& glExtensions()
+{
+	static GLExtensions extensions = GLExtensions();
+	return extensions;
+}
+
+// true if the context reports the extension. Must run on the GL thread.
+// ------------------------------------------------------------------------
+inline bool hasGLExtension(const char *name)
+{
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; i++)
+	{
+		const char *extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+		if (extension && strcmp(extension, name) == 0)
+			return true;
+	}
+	return false;
+}
+
+inline bool glVersionAtLeast(int major, int minor)
+{
+	return GLVersion.major > major || (GLVersion.major == major && GLVersion.minor >= minor);
+}
+
+// ------------------------------------------------------------------------
+inline void loadGLExtensions(GLADloadproc load)
+{
+	GLExtensions &ext = glExtensions();
+	ext = GLExtensions();
+
+	if (glVersionAtLeast(4, 1) || hasGLExtension("GL_ARB_get_program_binary"))
+	{
+		*(void**)&ext.GetProgramBinary = load("glGetProgramBinary");
+		*(void**)&ext.ProgramBinary = load("glProgramBinary");
+		*(void**)&ext.ProgramParameteri = load("glProgramParameteri");
+		GLint formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		ext.programBinary = ext.GetProgramBinary && ext.ProgramBinary && ext.ProgramParameteri && formats > 0;
+	}
+	if (hasGLExtension("GL_KHR_parallel_shader_compile"))
+		*(void**)&ext.MaxShaderCompilerThreads = load("glMaxShaderCompilerThreadsKHR");
+	else if (hasGLExtension("GL_ARB_parallel_shader_compile"))
+		*(void**)&ext.MaxShaderCompilerThreads = load("glMaxShaderCompilerThreadsARB");
+	ext.parallelShaderCompile = ext.MaxShaderCompilerThreads != NULL;
+	if (ext.parallelShaderCompile)
+		ext.MaxShaderCompilerThreads(0xFFFFFFFF);  // as many threads as the driver likes
+	if (glVersionAtLeast(4, 4) || hasGLExtension("GL_ARB_buffer_storage"))
+		*(void**)&ext.BufferStorage = load("glBufferStorage");
+	ext.bufferStorage = ext.BufferStorage != NULL;
+
+	if (!ext.programBinary)
+	{
+		ext.GetProgramBinary = NULL;
+		ext.ProgramBinary = NULL;
+		ext.ProgramParameteri = NULL;
+	}
+}
+#endif
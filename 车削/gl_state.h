@@ -0,0 +1,199 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <glad/glad.h>
+
+#include <cstdint>
+using namespace std;
+
+// Shadow copy of the GL binding state the renderer changes: program, vertex array, active texture unit,
+// the 2D and 2D array texture on every unit, the array and pixel unpack buffers and the depth function.
+// A change goes to the driver only if it differs from what is bound already; issued and elided calls are
+// counted per frame. Everything that binds or deletes these objects has to go through glState(), or the
+// shadow copy goes stale; deleting through it also forgets the bindings GL drops with the object, so a
+// recycled name is bound again. GL thread only.
+class GLState
+{
+public:
+	static const unsigned int MAX_TEXTURE_UNITS = 16;	// the minimum 3.3 guarantees for fragment shaders
+
+	GLState() : program(0), vertexArray(0), activeUnit(0), arrayBuffer(0), unpackBuffer(0), depth(GL_LESS),
+		issued(0), elided(0), frames(0), issuedTotal(0), elidedTotal(0), lastIssued(0), lastElided(0)
+	{
+		for (unsigned int i = 0; i < MAX_TEXTURE_UNITS; i++)
+			textures2D[i] = textureArrays[i] = 0;
+	}
+
+	void useProgram(GLuint id)
+	{
+		if (changed(program, id))
+			glUseProgram(id);
+	}
+
+	void bindVertexArray(GLuint id)
+	{
+		if (changed(vertexArray, id))
+			glBindVertexArray(id);
+	}
+
+	void activeTexture(unsigned int unit)
+	{
+		if (changed(activeUnit, unit))
+			glActiveTexture(GL_TEXTURE0 + unit);
+	}
+
+	// binds on the active unit
+	void bindTexture(GLenum target, GLuint id)
+	{
+		GLuint *bound = textureSlot(activeUnit, target);
+		if (!bound)
+		{
+			issued++;
+			glBindTexture(target, id);
+		}
+		else if (changed(*bound, id))
+			glBindTexture(target, id);
+	}
+
+	// binds on unit, switching the active unit only if the binding actually changes
+	void bindTexture(unsigned int unit, GLenum target, GLuint id)
+	{
+		GLuint *bound = textureSlot(unit, target);
+		if (bound && *bound == id)
+		{
+			elided++;
+			return;
+		}
+		activeTexture(unit);
+		bindTexture(target, id);
+	}
+
+	// GL_ARRAY_BUFFER and GL_PIXEL_UNPACK_BUFFER are tracked; other targets (the element buffer is vertex
+	// array state) are passed through
+	void bindBuffer(GLenum target, GLuint id)
+	{
+		GLuint *bound = target == GL_ARRAY_BUFFER ? &arrayBuffer : target == GL_PIXEL_UNPACK_BUFFER ? &unpackBuffer : NULL;
+		if (!bound)
+		{
+			issued++;
+			glBindBuffer(target, id);
+		}
+		else if (changed(*bound, id))
+			glBindBuffer(target, id);
+	}
+
+	void depthFunc(GLenum func)
+	{
+		if (changed(depth, func))
+			glDepthFunc(func);
+	}
+
+	// deletion, dropping the bindings GL drops with the objects
+	// ------------------------------------------------------------------------
+	void deleteTextures(GLsizei count, const GLuint *ids)
+	{
+		for (GLsizei i = 0; i < count; i++)
+		{
+			for (unsigned int unit = 0; unit < MAX_TEXTURE_UNITS; unit++)
+			{
+				if (textures2D[unit] == ids[i])
+					textures2D[unit] = 0;
+				if (textureArrays[unit] == ids[i])
+					textureArrays[unit] = 0;
+			}
+		}
+		glDeleteTextures(count, ids);
+	}
+
+	void deleteBuffers(GLsizei count, const GLuint *ids)
+	{
+		for (GLsizei i = 0; i < count; i++)
+		{
+			if (arrayBuffer == ids[i])
+				arrayBuffer = 0;
+			if (unpackBuffer == ids[i])
+				unpackBuffer = 0;
+		}
+		glDeleteBuffers(count, ids);
+	}
+
+	void deleteVertexArrays(GLsizei count, const GLuint *ids)
+	{
+		for (GLsizei i = 0; i < count; i++)
+			if (vertexArray == ids[i])
+				vertexArray = 0;
+		glDeleteVertexArrays(count, ids);
+	}
+
+	void deleteProgram(GLuint id)
+	{
+		if (program == id)
+			program = 0;
+		glDeleteProgram(id);
+	}
+
+	// statistics
+	// ------------------------------------------------------------------------
+	// closes the frame's counts
+	void endFrame()
+	{
+		lastIssued = issued;
+		lastElided = elided;
+		issuedTotal += issued;
+		elidedTotal += elided;
+		frames++;
+		issued = elided = 0;
+	}
+
+	unsigned int issuedLastFrame() const { return lastIssued; }
+	unsigned int elidedLastFrame() const { return lastElided; }
+	double issuedPerFrame() const { return frames > 0 ? (double)issuedTotal / frames : 0.0; }
+	double elidedPerFrame() const { return frames > 0 ? (double)elidedTotal / frames : 0.0; }
+	uint64_t frameCount() const { return frames; }
+
+private:
+	GLuint program;
+	GLuint vertexArray;
+	unsigned int activeUnit;
+	GLuint textures2D[MAX_TEXTURE_UNITS];
+	GLuint textureArrays[MAX_TEXTURE_UNITS];
+	GLuint arrayBuffer;
+	GLuint unpackBuffer;
+	GLenum depth;
+
+	unsigned int issued, elided;
+	uint64_t frames, issuedTotal, elidedTotal;
+	unsigned int lastIssued, lastElided;
+
+	// true (and counted as issued) if value differs from the shadow copy, which then takes it
+	template <typename T>
+	bool changed(T &current, T value)
+	{
+		if (current == value)
+		{
+			elided++;
+			return false;
+		}
+		current = value;
+		issued++;
+		return true;
+	}
+
+	GLuint* textureSlot(unsigned int unit, GLenum target)
+	{
+		if (unit >= MAX_TEXTURE_UNITS)
+			return NULL;
+		if (target == GL_TEXTURE_2D)
+			return &textures2D[unit];
+		if (target == GL_TEXTURE_2D_ARRAY)
+			return &textureArrays[unit];
+		return NULL;
+	}
+};
+
+inline GLState& glState()
+{
+	static GLState state;
+	return state;
+}
+#endif
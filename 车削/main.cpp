@@ -4,23 +4,40 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
 #include "shader.h"
 #include "camera.h"
 #include "model.h"
+#include "thread_pool.h"
+#include "baked_texture.h"
+#include "texture_streamer.h"
+#include "material_library.h"
+#include "uniform_buffer.h"
+#include "shader_variants.h"
+#include "gl_state.h"
+#include "stock_lod.h"
+#include "stock_vertex.h"
+#include "stream_buffer.h"
+#include "dynamic_resolution.h"
 #include <iostream>
 #include <vector>
 #include <string>
 #include <ctime>
+#include <memory>
 
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void mouse_button_callback(GLFWwindow* window, int button, int action, int mods);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
+void window_refresh_callback(GLFWwindow* window);
 void processInput(GLFWwindow *window);
-void loadPBRtextures();
-unsigned int loadTexture(const char *path);
-void initCylinder();  //ԲϢʼԲ,VAO,VBOͶ
+void usePBRmaterials(MaterialLibrary &materials);  //ǵǰʹõpbr(),ԤȡлĲ
+ModelData makeProxyToolData();  //ģ͵ǰʾĴ
+int warmTextureCache();  //ԤĻļ,
+void initCylinder();  //ԲϢʼԲ,VAO,VBOϸڲ
+void packStockCap(unsigned int end);  //ڲİ뾶Ǹ¶涥λ
 int FirstUnusedParticle();  //ҵparticlesеһ±
 void initParticle(int index); //±ʼ
 
@@ -37,14 +54,20 @@ float deltaTime = 0.0f;
 float lastFrame = 0.0f;
 
 // pbr
-const unsigned int PBR_TYPES = 3;
+// ǰPBR_SELECTABLEΪּѡδ,PBR_type+PBR_SELECTABLEΪӦ
+const unsigned int PBR_TYPES = 4;
+const unsigned int PBR_SELECTABLE = 2;
 unsigned int PBR_type = 0;
-string PBRtypes[PBR_TYPES] = { "rusted_iron","wood","Metal009" };
-unsigned int albedo[PBR_TYPES];
-unsigned int normal[PBR_TYPES];
-unsigned int metallic[PBR_TYPES];
-unsigned int roughness[PBR_TYPES];
-unsigned int ao[PBR_TYPES];
+string PBRtypes[PBR_TYPES] = { "rusted_iron","wood","Metal009","Metal024" };
+const char *PBR_DIR = "resources/textures/pbr";
+size_t PBR_budgetMB = 768;  //pbrռԴ(MB),ͬʱפĲ,--pbr-budget-mb޸
+int PBR_layerSize = 2048;  //ÿֲеı߳,--pbr-layer-size޸
+bool useTextureCompression = true;  //Կ֧ʱʹÿѹ,--no-texture-compressionر
+bool useNormalMaps = true;  //pbrʵķͼ,Ⱦʱ--no-normal-mapsرԼƬɫ
+double stockLodPixelError = 0.5;  //ԲϸڲĻ(),--stock-lod-error޸
+bool redrawOnDemand = false;  //ûб仯ʱػ,ȴ¼,--redraw-on-demand(ڳʱչʾ)
+double dynamicResolutionBudget = 0.0;  //άÿ֡֡ʱԤ(),0Ϊŷֱ,--dynamic-resolution޸
+bool usePersistentMapping = true;  //Կ֧ʱʽһֱӳ,--no-persistent-mappingΪÿдʱӳ
 
 
 //ԲϢ,עӦdoublefloat,⾫Ȳ³
@@ -55,19 +78,32 @@ const double lengthStep = 0.001;	//
 const double radiusStep = 0.001;	//뾶
 vector<int> radiusArray;			//뾶,ΪradiusStep
 vector<int> radiusMinArray;			//뾶Сֵ,涨뾶Сֵ,ڱߵ
-vector<glm::vec3> allPoints;		//е,㡢
-vector<unsigned int> indices;		//
+vector<unsigned char> cutArray;		//ÿǷ(0Ϊ,1Ϊ),Ͷеһ
+vector<StockPosition> stockPositions;	//жλú(ѹʽ),ʱдϴ
 
 unsigned int cylinderVAO;
-unsigned int cylinderVBO;
-unsigned int vertexNum; //
+unsigned int cylinderVBO;			//λú
+unsigned int cylinderSurfaceVBO;	//,ٱ仯
+unique_ptr<StockLod> stockLod;		//Բϸڲ:ĻϵĴСѡ,ֻؽ仯Ĳ
+const double STOCK_CULL_MARGIN = 0.1;	//ֻзֽǶʱ໭()
+
+//ÿ֡仯(Ķλáӵģ;󡢱)ʽϴ,ȴԿԭĻ
+unique_ptr<StreamBuffer> streamBuffer;
+const GLsizeiptr STREAM_SEGMENT_SIZE = 4 << 20;  //ÿ֡һ(ֽ),һ֡дʱǰһ
 
 
 //ӦĲü(׼豸,ΧΪ-1~1),ʼʱԲĴ
 const double clipX0 = 0.62, clipY0 = -0.2;  //ʼλ
 double clipX = clipX0, clipY = clipY0;  //λ
 bool isCut = false;  //Ƿ
+bool stockCut = false;  //ԲǷѾбĲ,֮ǰɫ岻ûĲ
 int mode = 0;  //ģʽ,0ʾģʽ,ָ,1ʾģʽ
+bool spindleRunning = true;  //Ƿת(Բת),ոл
+
+
+//ػ:ѻΪѱ仯;תӷɽԴڼʱÿ֡Ҫػ
+bool sceneDirty = true;
+const double IDLE_WAIT_TIMEOUT = 0.5;  //ûб仯ʱȴ¼ʱ()
 
 
 //ϵͳ
@@ -87,14 +123,88 @@ const double fadeMax = 0.01;		//
 bool isLeft = false;				//xٶǷ
 
 
+//pbrɫÿ֡Ҫõuniform,˳ʹShaderVariantsʱһ
+enum PbrUniform { PBR_MATERIAL_LAYERS };
+
+//ÿ֡uniform,õ͵ƹɫͬһ
+//std140:vec3vec4,ɫеFrameDataһ
+const unsigned int MAX_LIGHTS = ShaderFeatures::MAX_LIGHT_COUNT;
+const unsigned int FRAME_DATA_BINDING = 0;
+struct FrameData {
+	glm::mat4 view;
+	glm::mat4 projection;
+	glm::vec4 viewPos;
+	glm::vec4 lightPositions[MAX_LIGHTS];
+	glm::vec4 lightColors[MAX_LIGHTS];  //ûõĵƹɫΪ0
+};
+static_assert(sizeof(FrameData) == 272, "FrameData must match the std140 layout of the shader block");
+
+//ÿλƵı任:ģ;CPUõķ߾,ÿ
+//ÿռеһ,֮ʵԲʱÿʵҲԼĲ
+const unsigned int DRAW_TRANSFORM_BINDING = 1;
+enum DrawSlot { DRAW_STOCK, DRAW_TOOL, DRAW_SLOT_NUM };
+struct DrawTransform {
+	glm::mat4 model;
+	glm::vec4 normalMatrix[3];  //std140mat3ÿһаvec4
+
+	explicit DrawTransform(const glm::mat4 &model) : model(model) {
+		glm::mat3 normal = glm::inverseTranspose(glm::mat3(model));
+		for (int i = 0; i < 3; ++i) {
+			normalMatrix[i] = glm::vec4(normal[i], 0.0f);
+		}
+	}
+	//λѹʽʱ,ģ;,߾ԭģ;
+	DrawTransform(const glm::mat4 &model, const glm::mat4 &positionDecode) : DrawTransform(model) {
+		this->model = model * positionDecode;
+	}
+};
+static_assert(sizeof(DrawTransform) == 112, "DrawTransform must match the std140 layout of the shader block");
+
+
 //Bezier
 vector<glm::vec2> BezierPoints;     //Լ
 vector<glm::vec2> BezierCurvePoints;//ߵ,̶Ϊ100001
 
 unsigned int bezierVAO, bezierVBO, bezierCurveVAO, bezierCurveVBO;
 
-int main()
+const char *BACKGROUND_PATH = "resources/textures/background.bmp";
+const char *TOOL_MODEL_PATH = "resources/models/turningTool/turningTool.3ds";
+const double TEXTURE_UPLOAD_BUDGET = 0.004;  //ÿ֡ϴʱԤ()
+
+int main(int argc, char **argv)
 {
+	for (int i = 1; i < argc; ++i) {
+		string arg = argv[i];
+		//--warm-texture-cache: ֻ˳,ڰװԴԤ
+		if (arg == "--warm-texture-cache") {
+			return warmTextureCache();
+		}
+		if (arg == "--pbr-budget-mb" && i + 1 < argc) {
+			PBR_budgetMB = (size_t)atoi(argv[++i]);
+		}
+		if (arg == "--pbr-layer-size" && i + 1 < argc) {
+			PBR_layerSize = atoi(argv[++i]);
+		}
+		if (arg == "--no-texture-compression") {
+			useTextureCompression = false;
+		}
+		if (arg == "--no-normal-maps") {
+			useNormalMaps = false;
+		}
+		if (arg == "--stock-lod-error" && i + 1 < argc) {
+			stockLodPixelError = atof(argv[++i]);
+		}
+		if (arg == "--dynamic-resolution" && i + 1 < argc) {
+			dynamicResolutionBudget = atof(argv[++i]);
+		}
+		if (arg == "--redraw-on-demand") {
+			redrawOnDemand = true;
+		}
+		if (arg == "--no-persistent-mapping") {
+			usePersistentMapping = false;
+		}
+	}
+
 	glfwInit();
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
@@ -112,12 +222,18 @@ int main()
 	glfwSetMouseButtonCallback(window, mouse_button_callback);
 	glfwSetCursorPosCallback(window, mouse_callback);
 	glfwSetScrollCallback(window, scroll_callback);
+	glfwSetKeyCallback(window, key_callback);
+	glfwSetWindowRefreshCallback(window, window_refresh_callback);
 
 	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
 	{
 		std::cout << "Failed to initialize GLAD" << std::endl;
 		return -1;
 	}
+	//gladֻ3.3ĺ,ֵ֧չ(ƻ)
+	loadGLExtensions((GLADloadproc)glfwGetProcAddress);
+	streamBuffer.reset(new StreamBuffer(STREAM_SEGMENT_SIZE, 3, usePersistentMapping));
+	cout << "Stream buffer " << (streamBuffer->persistent() ? "persistently mapped" : "orphaned on wrap") << endl;
 
 	// openGLȫ
 	// -----------------------------
@@ -128,6 +244,48 @@ int main()
 	glad_glLineWidth(2);
 
 
+	// Դ첽
+	// ----------------
+	//ڴʼȾ,ͳģڹ߳н/,֮ÿ֡ʱԤϴ
+	//ѹ:Կֻ֧ûתļʱ˻δѹ
+	bool compressed = useTextureCompression && compressedTexturesSupported();
+	cout << "Texture compression " << (compressed ? "on" : "off") << endl;
+	ThreadPool assetPool;
+	unique_ptr<TextureStreamer> streamer(new TextureStreamer(assetPool, compressed));
+	future<ModelData> toolImport = assetPool.enqueue([compressed] { return Model::importModel(TOOL_MODEL_PATH, compressed); });
+
+	unsigned int bgTexture;
+	streamer->request(&bgTexture, BACKGROUND_PATH, true, glm::u8vec4(25, 25, 25, 255));
+	//pbrڵһʹʱż
+	unique_ptr<MaterialLibrary> materials(new MaterialLibrary(*streamer, PBR_DIR,
+		vector<string>(PBRtypes, PBRtypes + PBR_TYPES), PBR_layerSize, PBR_budgetMB << 20, compressed));
+	// pbrƹ
+	// ----------
+	glm::vec3 lightPositions[] = {
+		glm::vec3(0.0f, 0.0f, 4.0f)
+	};
+	glm::vec3 lightColors[] = {  //Դɫ:150.0fʾrgbе1.0f
+		glm::vec3(150.0f, 150.0f, 150.0f),
+	};
+	const unsigned int lightCount = min((unsigned int)(sizeof(lightPositions) / sizeof(lightPositions[0])), MAX_LIGHTS);
+
+	//ɫһύ,ֲ֧бʱں̨,ļ׼ͬʱ
+	//pbrɫƹǷ÷ͼǷʱɲͬı,ÿֱһõʱòuniform
+	ShaderVariants pbrShaders("cylinder.vs", "cylinder_pbr.fs", { "materialLayers" }, [](Shader &shader) {
+		shader.setInt("albedoMap", MaterialLibrary::ALBEDO);
+		shader.setInt("normalMap", MaterialLibrary::NORMAL);
+		shader.setInt("ormMap", MaterialLibrary::ORM);
+		shader.bindUniformBlock("FrameData", FRAME_DATA_BINDING);
+		shader.bindUniformBlock("DrawTransform", DRAW_TRANSFORM_BINDING);
+	});
+	Shader &pbrStartShader = pbrShaders.request(ShaderFeatures(lightCount, useNormalMaps, false));
+	pbrShaders.request(ShaderFeatures(lightCount, useNormalMaps, true));  //һʱصȴ
+	Shader modelShader("model.vs", "model.fs", true);
+	Shader particleShader("particle.vs", "particle.fs", true);
+	Shader bgShader("background.vs", "background.fs", true);
+	Shader bezierShader("bezier.vs", "bezier.fs", true);
+
+
 	// ϵͳʼ
 	// ----------------
 	for (int i = 0; i < PARTICLE_NUM; ++i) {
@@ -171,47 +329,42 @@ int main()
 	}
 
 	//ϵͳ
-	unsigned int particleVAO, particleVBO, modelMatrixVBO;
+	unsigned int particleVAO, particleVBO;
 	glGenVertexArrays(1, &particleVAO);
 	glGenBuffers(1, &particleVBO);
-	glGenBuffers(1, &modelMatrixVBO);
-	glBindVertexArray(particleVAO);
-	glBindBuffer(GL_ARRAY_BUFFER, particleVBO);
+	glState().bindVertexArray(particleVAO);
+	glState().bindBuffer(GL_ARRAY_BUFFER, particleVBO);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(particleVertex), particleVertex, GL_STATIC_DRAW);
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
 	glEnableVertexAttribArray(0);
 	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
 	glEnableVertexAttribArray(1);
-	glBindBuffer(GL_ARRAY_BUFFER, modelMatrixVBO);
-	glBufferData(GL_ARRAY_BUFFER, PARTICLE_NUM * sizeof(glm::mat4), &modelMatrices[0], GL_STREAM_DRAW);
-	glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(0));
-	glEnableVertexAttribArray(2);
-	glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(sizeof(glm::vec4)));
-	glEnableVertexAttribArray(3);
-	glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(2 * sizeof(glm::vec4)));
-	glEnableVertexAttribArray(4);
-	glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(3 * sizeof(glm::vec4)));
-	glEnableVertexAttribArray(5);
+	//ģ;ÿ֡дʽ,֮ǰָдλ
+	glState().bindBuffer(GL_ARRAY_BUFFER, streamBuffer->id());
+	for (int column = 0; column < 4; ++column) {
+		glVertexAttribPointer(2 + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(column * sizeof(glm::vec4)));
+		glEnableVertexAttribArray(2 + column);
+	}
 	//ÿʵʹģ;,Ƕÿ
 	glVertexAttribDivisor(2, 1);
 	glVertexAttribDivisor(3, 1);
 	glVertexAttribDivisor(4, 1);
 	glVertexAttribDivisor(5, 1);
 	glVertexAttribDivisor(6, 1);
-	glBindVertexArray(0);
+	glState().bindVertexArray(0);
 
 	//ͼƬ
 	unsigned int bgVAO, bgVBO;
 	glGenVertexArrays(1, &bgVAO);
 	glGenBuffers(1, &bgVBO);
-	glBindVertexArray(bgVAO);
-	glBindBuffer(GL_ARRAY_BUFFER, bgVBO);
+	glState().bindVertexArray(bgVAO);
+	glState().bindBuffer(GL_ARRAY_BUFFER, bgVBO);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(backgroundVertex), backgroundVertex, GL_STATIC_DRAW);
 	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
 	glEnableVertexAttribArray(0);
 	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)(2 * sizeof(float)));
 	glEnableVertexAttribArray(1);
-	glBindVertexArray(0);
+	glState().bindVertexArray(0);
 
 	//Bezier
 	glGenVertexArrays(1, &bezierVAO);
@@ -220,73 +373,55 @@ int main()
 	glGenBuffers(1, &bezierCurveVBO);
 
 	//Լ
-	glBindVertexArray(bezierVAO);
-	glBindBuffer(GL_ARRAY_BUFFER, bezierVBO);
+	glState().bindVertexArray(bezierVAO);
+	glState().bindBuffer(GL_ARRAY_BUFFER, bezierVBO);
 	glBufferData(GL_ARRAY_BUFFER, 4 * sizeof(glm::vec2), nullptr, GL_DYNAMIC_DRAW);
 	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
 	glEnableVertexAttribArray(0);
-	glBindVertexArray(0);
+	glState().bindVertexArray(0);
 	//Bezierߵ
-	glBindVertexArray(bezierCurveVAO);
-	glBindBuffer(GL_ARRAY_BUFFER, bezierCurveVBO);
+	glState().bindVertexArray(bezierCurveVAO);
+	glState().bindBuffer(GL_ARRAY_BUFFER, bezierCurveVBO);
 	glBufferData(GL_ARRAY_BUFFER, 100001 * sizeof(glm::vec2), nullptr, GL_DYNAMIC_DRAW);   //bezierߵ̶Ϊ100001
 	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
 	glEnableVertexAttribArray(0);
-	glBindVertexArray(0);
-
-
-
-	// 
-	// -------------
-	unsigned int bgTexture = loadTexture("resources/textures/background.bmp");
-
-
-
-	//pbrʱ
-	clock_t startTime, endTime;
-	startTime = clock();//ʱʼ
-
-	loadPBRtextures();
-
-	endTime = clock();//ʱ
-	cout << "The run time is: " << (double)(endTime - startTime) / (time_t)1000 << "s" << endl;
+	glState().bindVertexArray(0);
 
 
 
 	// ɫ
 	// --------------------
-	Shader cylinderShader_pbr("cylinder.vs", "cylinder_pbr.fs");
-	Shader modelShader("model.vs", "model.fs");
-	Shader particleShader("particle.vs", "particle.fs");
-	Shader bgShader("background.vs", "background.fs");
-	Shader bezierShader("bezier.vs", "bezier.fs");
-
-	//pbrģ
-	cylinderShader_pbr.use();
-	cylinderShader_pbr.setInt("albedoMap", 0);
-	cylinderShader_pbr.setInt("normalMap", 1);
-	cylinderShader_pbr.setInt("metallicMap", 2);
-	cylinderShader_pbr.setInt("roughnessMap", 3);
-	cylinderShader_pbr.setInt("aoMap", 4);
-	cylinderShader_pbr.setInt("albedoMap1", 5);
-	cylinderShader_pbr.setInt("normalMap1", 6);
-	cylinderShader_pbr.setInt("metallicMap1", 7);
-	cylinderShader_pbr.setInt("roughnessMap1", 8);
-	cylinderShader_pbr.setInt("aoMap1", 9);
+	//ȴ̨,ڼϴѽ;ֲ֧бʱfinish()ֱ
+	Shader *shaders[] = { &pbrStartShader, &modelShader, &particleShader, &bgShader, &bezierShader };
+	const unsigned int SHADER_NUM = sizeof(shaders) / sizeof(shaders[0]);
+	double shaderWaitStart = glfwGetTime();
+	for (unsigned int i = 0; i < SHADER_NUM; ++i) {
+		while (!shaders[i]->isReady()) {
+			streamer->update(TEXTURE_UPLOAD_BUDGET);
+			this_thread::sleep_for(chrono::milliseconds(1));
+		}
+		shaders[i]->finish();
+	}
+	cout << "Shaders ready after " << glfwGetTime() << "s (waited " << (glfwGetTime() - shaderWaitStart) * 1000.0 << " ms)" << endl;
 
-	// pbrƹ
-	// ----------
-	glm::vec3 lightPositions[] = {
-		glm::vec3(0.0f, 0.0f, 4.0f)
-	};
-	glm::vec3 lightColors[] = {  //Դɫ:150.0fʾrgbе1.0f
-		glm::vec3(150.0f, 150.0f, 150.0f),
-	};
+	//ģ͵Ĳʲ󶨵̶Ԫ,ʱֻ
+	bindMaterialSamplers(modelShader);
 
+	//͵ƹڹuniform,ÿֻ֡һ
+	unique_ptr<UniformBuffer<FrameData>> frameUniforms(new UniformBuffer<FrameData>(FRAME_DATA_BINDING));
+	particleShader.bindUniformBlock("FrameData", FRAME_DATA_BINDING);
+	unique_ptr<UniformBufferArray<DrawTransform>> drawTransforms(new UniformBufferArray<DrawTransform>(DRAW_TRANSFORM_BINDING, DRAW_SLOT_NUM));
+	modelShader.bindUniformBlock("DrawTransform", DRAW_TRANSFORM_BINDING);
+
+	//uniformλֻһ,Ⱦѭֱþ
+	const GLint particleLayerLoc = particleShader.uniform("particleLayer");
 
 	// 3dģ:
 	// -----------
-	Model myModel("resources/models/turningTool/turningTool.3ds");
+	//ǰȻ
+	ModelData proxyData = makeProxyToolData();
+	unique_ptr<Model> proxyModel(new Model(proxyData));
+	unique_ptr<Model> myModel;
 
 
 	// ģ͡ͼͶӰ
@@ -294,20 +429,74 @@ int main()
 	glm::mat4 model, view, projection;
 	// תǶ
 	float angle = 0.0f;
+	// Բһ֡ĿзֽǶȵļ
+	unsigned int stockChunks = 0, stockStride = 0;
+	// ֱ̬:ά֡ʱԤŵ,ٷŴ󵽴;߰ڷֱʻ
+	unique_ptr<DynamicResolution> dynamicResolution;
+	if (dynamicResolutionBudget > 0.0) {
+		dynamicResolution.reset(new DynamicResolution(dynamicResolutionBudget / 1000.0));
+	}
 
 
+	//ʱ(glfwʱglfwInitʼ)
+	bool firstFrame = true, assetsReady = false;
+	//ػʱȴʱ;֡ʾˢʴ,ѵĴ
+	double idleSeconds = 0.0;
+	const GLFWvidmode *videoMode = glfwGetVideoMode(glfwGetPrimaryMonitor());
+	const double refreshRate = videoMode && videoMode->refreshRate > 0 ? videoMode->refreshRate : 60.0;
+
 	while (!glfwWindowShouldClose(window))
 	{
+		//ػ:ûб仯Ҳûжʱȴ¼,ػ
+		if (redrawOnDemand && !sceneDirty && !spindleRunning && !isCut && assetsReady && !streamer->busy()) {
+			double idleStart = glfwGetTime();
+			glfwWaitEventsTimeout(IDLE_WAIT_TIMEOUT);
+			idleSeconds += glfwGetTime() - idleStart;
+			lastFrame = glfwGetTime();  //ȴʱ䲻ƶʱ,Ҳֱ̬ʵ֡ʱ
+			if (dynamicResolution) {
+				dynamicResolution->restartTiming();
+			}
+			continue;
+		}
+		sceneDirty = false;
+
 		float currentFrame = glfwGetTime();
 		deltaTime = currentFrame - lastFrame;
 		lastFrame = currentFrame;
 
+		// ϴѽԴ
+		// -----
+		usePBRmaterials(*materials);
+		streamer->update(TEXTURE_UPLOAD_BUDGET);
+		materials->update();
+		if (!myModel && toolImport.wait_for(chrono::seconds(0)) == future_status::ready) {
+			ModelData toolData = toolImport.get();
+			//ҪCPU˲ѯ,ϴͷŶ
+			myModel.reset(new Model(toolData, false, false));
+			proxyModel.reset();
+			cout << "Tool model: " << myModel->meshCount() << " meshes, " << myModel->materialCount() << " materials, 1 draw call" << endl;
+		}
+		if (!assetsReady && myModel && !streamer->busy()) {
+			assetsReady = true;
+			cout << "All assets loaded after " << glfwGetTime() << "s" << endl;
+			TextureCache &textureCache = TextureCache::instance();
+			cout << "Shared textures: " << textureCache.size() << ", hit rate " << textureCache.hitRate() * 100.0
+				<< "% of " << textureCache.lookupCount() << " lookups" << endl;
+		}
+
 		// 
 		// -----
 		processInput(window);
 
 		// Ⱦ
 		// ------
+		int framebufferWidth, framebufferHeight;
+		glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+		if (dynamicResolution) {
+			dynamicResolution->begin(framebufferWidth, framebufferHeight);
+			framebufferWidth = dynamicResolution->renderWidth();  //ϸڲΰʵȾѡ
+			framebufferHeight = dynamicResolution->renderHeight();
+		}
 		glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -320,48 +509,43 @@ int main()
 		projection = glm::ortho(-orthoSize, orthoSize, -orthoSize, orthoSize, orthoSize, -0.0f);
 		projection = glm::mat4(1.0f);  //ͶӰΪλ,ΪĬϵͶӰ
 
+		//͵ƹһϴ,ɫ
+		FrameData frameData = FrameData();
+		frameData.view = view;
+		frameData.projection = projection;
+		frameData.viewPos = glm::vec4(camera.Position, 1.0f);
+		//pbrĵԴ(ΪԴ,MAX_LIGHTS)
+		for (unsigned int i = 0; i < lightCount; ++i) {
+			frameData.lightPositions[i] = glm::vec4(lightPositions[i], 1.0f);
+			frameData.lightColors[i] = glm::vec4(lightColors[i], 0.0f);
+		}
+		frameUniforms->update(frameData);
+
 		// Բ壺pbrģ
 		// ------------------------
-		cylinderShader_pbr.use();
+		ShaderVariants::Variant &pbr = pbrShaders.get(ShaderFeatures(lightCount, useNormalMaps, stockCut));
+		pbr.shader.use();
 		model = glm::mat4(1.0f);
 		model = glm::translate(model, glm::vec3(0.5f, 0.0f, 0.0f));
 		//Բת
 		model = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.0f, 0.0f));
 		model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-		cylinderShader_pbr.setMat4("model", model);
-		cylinderShader_pbr.setMat4("view", view);
-		cylinderShader_pbr.setMat4("projection", projection);
-		cylinderShader_pbr.setVec3("viewPos", camera.Position);
-		//pbr
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, albedo[PBR_type]);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, normal[PBR_type]);
-		glActiveTexture(GL_TEXTURE2);
-		glBindTexture(GL_TEXTURE_2D, metallic[PBR_type]);
-		glActiveTexture(GL_TEXTURE3);
-		glBindTexture(GL_TEXTURE_2D, roughness[PBR_type]);
-		glActiveTexture(GL_TEXTURE4);
-		glBindTexture(GL_TEXTURE_2D, ao[PBR_type]);
-		glActiveTexture(GL_TEXTURE5);
-		glBindTexture(GL_TEXTURE_2D, albedo[PBR_type+2]);
-		glActiveTexture(GL_TEXTURE6);
-		glBindTexture(GL_TEXTURE_2D, normal[PBR_type+2]);
-		glActiveTexture(GL_TEXTURE7);
-		glBindTexture(GL_TEXTURE_2D, metallic[PBR_type+2]);
-		glActiveTexture(GL_TEXTURE8);
-		glBindTexture(GL_TEXTURE_2D, roughness[PBR_type+2]);
-		glActiveTexture(GL_TEXTURE9);
-		glBindTexture(GL_TEXTURE_2D, ao[PBR_type+2]);
-		glBindVertexArray(cylinderVAO);
-		glDrawElements(GL_TRIANGLES, vertexNum, GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
-		//pbrĵԴλ(ΪԴ,4)
-		for (unsigned int i = 0; i < sizeof(lightPositions) / sizeof(lightPositions[0]); ++i) {
-			glm::vec3 newPos = lightPositions[i] + glm::vec3(sin(glfwGetTime() * 5.0) * 5.0, 0.0, 0.0);
-			newPos = lightPositions[i];
-			cylinderShader_pbr.setVec3("lightPositions[" + std::to_string(i) + "]", newPos);
-			cylinderShader_pbr.setVec3("lightColors[" + std::to_string(i) + "]", lightColors[i]);
+		drawTransforms->set(DRAW_STOCK, DrawTransform(model, stockPositionDecode(cylinderRadius, cylinderLength)));
+		//pbr:δĲͬһ,ѡ
+		unsigned int cutType = PBR_type + PBR_SELECTABLE;
+		for (unsigned int m = 0; m < MaterialLibrary::MAP_COUNT; ++m)
+			glState().bindTexture(m, GL_TEXTURE_2D_ARRAY, materials->texture((MaterialLibrary::Map)m));
+		pbr.shader.setVec2(pbr.uniforms[PBR_MATERIAL_LAYERS], materials->layer(PBR_type), materials->layer(cutType));
+		//ÿ鰴ԼĻϵĴСѡϸڲ,ҰĿ鲻
+		//߷(ƽͶӰ,ָ)任ԲģͿռ,зֽǶȺͶ治
+		glm::vec3 toEye = glm::transpose(glm::mat3(view * model)) * glm::vec3(0.0f, 0.0f, 1.0f);
+		stockLod->draw(cylinderVAO, radiusArray, cutArray, StockLod::facing(toEye, STOCK_CULL_MARGIN),
+			projection * view * model, glm::vec2(framebufferWidth, framebufferHeight), stockLodPixelError);
+		if (stockLod->chunksDrawn() != stockChunks || stockLod->sliceStride() != stockStride) {
+			stockChunks = stockLod->chunksDrawn();
+			stockStride = stockLod->sliceStride();
+			cout << "Stock LOD: " << stockChunks << " of " << stockLod->chunkCount() << " chunks, every " << stockStride
+				<< " slices, " << stockLod->triangleCount() << " triangles" << endl;
 		}
 
 
@@ -369,12 +553,9 @@ int main()
 		// -------------
 		if (isCut) {
 			particleShader.use();
-			particleShader.setMat4("view", view);
-			particleShader.setMat4("projection", projection);
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, albedo[PBR_type+2]);
-			glBindVertexArray(particleVAO);
-			glBindBuffer(GL_ARRAY_BUFFER, modelMatrixVBO);
+			particleShader.setFloat(particleLayerLoc, materials->layer(PBR_type + PBR_SELECTABLE));
+			glState().bindTexture(0, GL_TEXTURE_2D_ARRAY, materials->texture(MaterialLibrary::ALBEDO));
+			glState().bindVertexArray(particleVAO);
 
 			int UsedParticle = 0;
 			modelMatrices.clear();
@@ -393,10 +574,14 @@ int main()
 					UsedParticle++;
 				}
 			}
-			glBufferSubData(GL_ARRAY_BUFFER, 0, UsedParticle * sizeof(glm::mat4), &modelMatrices[0]);
-			//ֻlife>0.0f,ʵ(Ȼû,ΪglBufferSubDataֳΪƿ)
-			glDrawArraysInstanced(GL_TRIANGLES, 0, 6, UsedParticle);
-			glBindVertexArray(0);
+			//ֻlife>0.0f,ʵ;ģ;дʽ,ȴһ֡Ļ
+			if (UsedParticle > 0) {
+				GLintptr offset = streamBuffer->write(&modelMatrices[0], UsedParticle * sizeof(glm::mat4));
+				glState().bindBuffer(GL_ARRAY_BUFFER, streamBuffer->id());
+				for (int column = 0; column < 4; ++column)
+					glVertexAttribPointer(2 + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(offset + column * sizeof(glm::vec4)));
+				glDrawArraysInstanced(GL_TRIANGLES, 0, 6, UsedParticle);
+			}
 		}
 
 
@@ -415,20 +600,23 @@ int main()
 		model = glm::rotate(model, glm::radians(90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
 		model = glm::rotate(model, glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
 		model = glm::scale(model, glm::vec3(0.02f));
-		modelShader.setMat4("model", model);
-		myModel.Draw(modelShader);
+		drawTransforms->set(DRAW_TOOL, DrawTransform(model));
+		(myModel ? *myModel : *proxyModel).Draw();
 
 
 		// ͼƬ
 		// -------------
-		glDepthFunc(GL_LEQUAL);   //ñ()
+		glState().depthFunc(GL_LEQUAL);   //ñ()
 		bgShader.use();
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, bgTexture);
-		glBindVertexArray(bgVAO);
+		glState().bindTexture(0, GL_TEXTURE_2D, bgTexture);
+		glState().bindVertexArray(bgVAO);
 		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glBindVertexArray(0);
-		glDepthFunc(GL_LESS);
+		glState().depthFunc(GL_LESS);
+
+		//ȾĳŴ󵽴,֮ıֱӻڴ
+		if (dynamicResolution) {
+			dynamicResolution->end();
+		}
 
 
 		// bezier
@@ -436,15 +624,13 @@ int main()
 		bezierShader.use();
 
 		//bezierߵԼ
-		glBindVertexArray(bezierVAO);
+		glState().bindVertexArray(bezierVAO);
 		glDrawArrays(GL_POINTS, 0, BezierPoints.size());
-		glBindVertexArray(0);
 
 		//bezier
 		if (BezierPoints.size() == 4) {
-			glBindVertexArray(bezierCurveVAO);
+			glState().bindVertexArray(bezierCurveVAO);
 			glDrawArrays(GL_LINE_STRIP, 0, BezierCurvePoints.size());
-			glBindVertexArray(0);
 		}
 
 
@@ -452,7 +638,8 @@ int main()
 		// --------------
 
 		//ת
-		angle += 0.8f;
+		if (spindleRunning)
+			angle += 0.8f;
 
 		//ϵͳ
 
@@ -475,20 +662,47 @@ int main()
 		}
 
 		glfwSwapBuffers(window);
+		glState().endFrame();
+		streamBuffer->endFrame();
 		glfwPollEvents();
+
+		if (firstFrame) {
+			firstFrame = false;
+			cout << "First frame after " << glfwGetTime() << "s" << endl;
+		}
 	}
 
-	glDeleteVertexArrays(1, &cylinderVAO);
-	glDeleteVertexArrays(1, &particleVAO);
-	glDeleteVertexArrays(1, &bgVAO);
-	glDeleteVertexArrays(1, &bezierVAO);
-	glDeleteVertexArrays(1, &bezierCurveVAO);
-	glDeleteBuffers(1, &cylinderVBO);
-	glDeleteBuffers(1, &particleVBO);
-	glDeleteBuffers(1, &modelMatrixVBO);
-	glDeleteBuffers(1, &bgVBO);
-	glDeleteBuffers(1, &bezierVAO);
-	glDeleteBuffers(1, &bezierCurveVAO);
+	cout << "GL state changes per frame: " << glState().issuedPerFrame() << " issued, "
+		<< glState().elidedPerFrame() << " skipped as redundant (" << glState().frameCount() << " frames)" << endl;
+	cout << "Stream buffer: " << streamBuffer->bytesPerFrame() / 1024.0 << " KB per frame, "
+		<< streamBuffer->stallCount() << " waits for the GPU" << endl;
+	if (dynamicResolution)
+		cout << "Dynamic resolution: average scale " << dynamicResolution->averageScale() << ", lowest "
+			<< dynamicResolution->minimumScale() << endl;
+	if (redrawOnDemand)
+		cout << "Redraw on demand: " << (unsigned long long)(idleSeconds * refreshRate + 0.5) << " frames skipped at "
+			<< refreshRate << " Hz, idle for " << idleSeconds << "s" << endl;
+
+	dynamicResolution.reset();
+	glState().deleteVertexArrays(1, &cylinderVAO);
+	glState().deleteVertexArrays(1, &particleVAO);
+	glState().deleteVertexArrays(1, &bgVAO);
+	glState().deleteVertexArrays(1, &bezierVAO);
+	glState().deleteVertexArrays(1, &bezierCurveVAO);
+	glState().deleteBuffers(1, &cylinderVBO);
+	glState().deleteBuffers(1, &cylinderSurfaceVBO);
+	glState().deleteBuffers(1, &particleVBO);
+	glState().deleteBuffers(1, &bgVBO);
+	glState().deleteBuffers(1, &bezierVBO);
+	glState().deleteBuffers(1, &bezierCurveVBO);
+	myModel.reset();
+	proxyModel.reset();
+	materials.reset();
+	frameUniforms.reset();
+	drawTransforms.reset();
+	stockLod.reset();
+	streamBuffer.reset();
+	streamer.reset();  //Ҫ֮ǰɾ
 
 	glfwTerminate();
 	return 0;
@@ -508,13 +722,16 @@ void processInput(GLFWwindow *window)
 		camera.ProcessKeyboard(LEFT, deltaTime);
 	if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
 		camera.ProcessKeyboard(RIGHT, deltaTime);
+	if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS
+		|| glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
+		sceneDirty = true;  //סƶʱÿ֡ƶ
 
 
-	if (glfwGetKey(window, GLFW_KEY_1) == GLFW_PRESS) {
-		PBR_type = 0;
-	}
-	if (glfwGetKey(window, GLFW_KEY_2) == GLFW_PRESS) {
-		PBR_type = 1;
+	//ּ1,2,...ѡ
+	for (unsigned int type = 0; type < PBR_SELECTABLE && type < 9; ++type) {
+		if (glfwGetKey(window, GLFW_KEY_1 + type) == GLFW_PRESS) {
+			PBR_type = type;
+		}
 	}
 
 	if (glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS) {
@@ -527,15 +744,14 @@ void processInput(GLFWwindow *window)
 
 
 void mouse_button_callback(GLFWwindow* window, int button, int action, int mods) {
+	sceneDirty = true;
 	if (mode == 0) {
 		if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS) {
 			if (clipX <= clipX0) {
 				int size = BezierPoints.size();
 				if (size == 0 || (size < 4 && BezierPoints[size - 1].x != clipX)) {  //4Լ
 					BezierPoints.push_back(glm::vec2(clipX, clipY));
-					glBindBuffer(GL_ARRAY_BUFFER, bezierVBO);
-					glBufferSubData(GL_ARRAY_BUFFER, 0, BezierPoints.size() * sizeof(glm::vec2), &BezierPoints[0]);
-					glBindBuffer(GL_ARRAY_BUFFER, 0);
+					streamBuffer->upload(bezierVBO, 0, &BezierPoints[0], BezierPoints.size() * sizeof(glm::vec2));
 
 					if (BezierPoints.size() == 4) {  //4Լ,ߵ
 						float curveX, curveY;
@@ -545,9 +761,7 @@ void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
 							curveY = p0.y * glm::pow((1 - t), 3) + 3 * p1.y * t * glm::pow((1 - t), 2) + 3 * p2.y * t * t * (1 - t) + p3.y * pow(t, 3);
 							BezierCurvePoints.push_back(glm::vec2(curveX, curveY));
 						}
-						glBindBuffer(GL_ARRAY_BUFFER, bezierCurveVBO);
-						glBufferSubData(GL_ARRAY_BUFFER, 0, BezierCurvePoints.size() * sizeof(glm::vec2), &BezierCurvePoints[0]);
-						glBindBuffer(GL_ARRAY_BUFFER, 0);
+						streamBuffer->upload(bezierCurveVBO, 0, &BezierCurvePoints[0], BezierCurvePoints.size() * sizeof(glm::vec2));
 
 
 						//°뾶Сֵ
@@ -584,11 +798,13 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 		WIN_HEIGHT = height;
 	}
 	glViewport(0, 0, width, height);
+	sceneDirty = true;
 }
 
 
 void mouse_callback(GLFWwindow* window, double xpos, double ypos)
 {
+	sceneDirty = true;  //ƶ
 	//ĻתΪü(-1~1Χ)
 	double newClipX = xpos * 2.0 / (double)(WIN_WIDTH - 1) - 1.0;
 	double newClipY = -ypos * 2.0 / (double)(WIN_HEIGHT - 1) + 1.0;
@@ -622,12 +838,12 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos)
 					//°뾶
 					if (radiusArray[i] > newRadius&&radiusArray[i] > radiusMinArray[i]) {  //С뾶ܱа뾶С
 						isCut = true;
+						stockCut = true;
 						radiusArray[i] = newRadius < radiusMinArray[i] ? radiusMinArray[i] : newRadius; //°뾶а뾶С,>=涨С뾶
 					}
 				}
 
-				//VBO
-				glBindBuffer(GL_ARRAY_BUFFER, cylinderVBO);
+				//VBO(ʽ帴,ȴԿһ֡)
 				if (isCut) {
 					if (newClipX < clipX) { //,ٶȷӦ
 						isLeft = false;
@@ -636,24 +852,38 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos)
 						isLeft = true;
 					}
 
+					//ֻдеĿ;߽ϵĲһ,Ҫд
 					int slices = 360 / angleStep;
-					for (int i = 0; i <= slices; ++i) {
-						for (int j = zStart; j <= zEnd; ++j) {
-							int pointOffset = (i*(stacks + 1) + j) * 3;
-							glm::vec3 newPoint = allPoints[pointOffset];
+					for (unsigned int c = 0; c < stockLod->chunkCount(); ++c) {
+						int first = glm::max(zStart, stockLod->chunkFirstStack(c)), last = glm::min(zEnd, stockLod->chunkLastStack(c));
+						if (first > last)
+							continue;
+						for (int i = 0; i <= slices; ++i) {
 							float alpha = i * angleStep;
-							float newR = radiusArray[j] * radiusStep;
-							newPoint.x = newR * (float)glm::cos(glm::radians(alpha));
-							newPoint.y = newR * (float)glm::sin(glm::radians(alpha));
-							float isCut = 1.0f;
-							glBufferSubData(GL_ARRAY_BUFFER, 3 * sizeof(float) * pointOffset, 2 * sizeof(float), &newPoint);
-							glBufferSubData(GL_ARRAY_BUFFER, 3 * sizeof(float) * pointOffset + 2 * sizeof(glm::vec3) +2* sizeof(float), sizeof(float), &isCut);
-							allPoints[pointOffset] = newPoint;
+							for (int j = first; j <= last; ++j) {
+								float newR = radiusArray[j] * radiusStep;
+								glm::vec3 newPoint(newR * (float)glm::cos(glm::radians(alpha)), newR * (float)glm::sin(glm::radians(alpha)), lengthStep * j);
+								stockPositions[stockLod->vertex(c, i, j)] = packStockPosition(newPoint, true, cylinderRadius, cylinderLength);
+							}
+							//ͬһзֽǶϱĶ,һϴ;겻,ϴ
+							unsigned int v = stockLod->vertex(c, i, first);
+							streamBuffer->upload(cylinderVBO, v * sizeof(StockPosition), &stockPositions[v], (last - first + 1) * sizeof(StockPosition));
 						}
-
 					}
+					for (int j = zStart; j <= zEnd; ++j) {
+						cutArray[j] = 1;
+					}
+					//еʱҲҪ
+					for (unsigned int end = 0; end < 2; ++end) {
+						int stack = end == 0 ? 0 : stacks;
+						if (zStart <= stack && stack <= zEnd) {
+							packStockCap(end);
+							unsigned int first = stockLod->capVertex(end, -1);
+							streamBuffer->upload(cylinderVBO, first * sizeof(StockPosition), &stockPositions[first], (slices + 2) * sizeof(StockPosition));
+						}
+					}
+					stockLod->invalidate(zStart, zEnd);  //ֻؽһڵĿ
 				}
-				glBindBuffer(GL_ARRAY_BUFFER, 0);
 			}
 		}
 	}
@@ -668,65 +898,126 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos)
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 {
 	camera.ProcessMouseScroll(yoffset);
+	sceneDirty = true;
+}
+
+
+//processInputаǰ״̬,ֻѰػ沢Ҫһлһεļ
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+	sceneDirty = true;
+	if (key == GLFW_KEY_SPACE && action == GLFW_PRESS)
+		spindleRunning = !spindleRunning;  ///ֹͣ
+}
+
+
+//ڱڵʾʱҪػ
+void window_refresh_callback(GLFWwindow* window)
+{
+	sceneDirty = true;
 }
 
 // ͼpbr
 // ---------------------------------------------------
-void loadPBRtextures()
+void usePBRmaterials(MaterialLibrary &materials)
+{
+	materials.use(PBR_type);
+	materials.use(PBR_type + PBR_SELECTABLE);
+
+	//пԤʱԤȡڰӦĲ,лʱͲٵȴ
+	for (unsigned int step = 1; step < PBR_SELECTABLE; ++step) {
+		unsigned int next = (PBR_type + step) % PBR_SELECTABLE;
+		materials.prefetch(next);
+		materials.prefetch(next + PBR_SELECTABLE);
+	}
+}
+
+
+ModelData makeProxyToolData()
 {
-	for (int type = 0; type < PBR_TYPES; ++type) {
-		string folder = PBRtypes[type];
-		string filepath1 = "resources/textures/pbr/" + folder + "/albedo.png";
-		string filepath2 = "resources/textures/pbr/" + folder + "/normal.png";
-		string filepath3 = "resources/textures/pbr/" + folder + "/metallic.png";
-		string filepath4 = "resources/textures/pbr/" + folder + "/roughness.png";
-		string filepath5 = "resources/textures/pbr/" + folder + "/ao.png";
-
-		albedo[type] = loadTexture(filepath1.c_str());
-		normal[type] = loadTexture(filepath2.c_str());
-		metallic[type] = loadTexture(filepath3.c_str());
-		roughness[type] = loadTexture(filepath4.c_str());
-		ao[type] = loadTexture(filepath5.c_str());
+	//ģ(turningTool.3ds)ģͿռеİΧ
+	const glm::vec3 boxMin(-18.9f, -6.0f, -6.3f), boxMax(-8.9f, 5.0f, 43.7f);
+	const glm::vec3 faceNormals[6] = {
+		glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f),
+		glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f)
+	};
+
+	MeshData box;
+	for (int f = 0; f < 6; ++f) {
+		//ÿȡ߷ϵ4ǵ,ʱ˳
+		glm::vec3 n = faceNormals[f];
+		glm::vec3 u = glm::vec3(n.y != 0.0f || n.z != 0.0f ? 1.0f : 0.0f, n.x != 0.0f ? 1.0f : 0.0f, 0.0f);
+		glm::vec3 v = glm::cross(n, u);
+		glm::vec2 corners[4] = { glm::vec2(-1, -1), glm::vec2(1, -1), glm::vec2(1, 1), glm::vec2(-1, 1) };
+		unsigned int first = box.vertices.size();
+		for (int c = 0; c < 4; ++c) {
+			glm::vec3 unit = n + u * corners[c].x + v * corners[c].y;  //λ[-1,1]ϵĵ
+			Vertex vertex = Vertex();
+			vertex.Position = boxMin + (unit * 0.5f + 0.5f) * (boxMax - boxMin);
+			vertex.Normal = n;
+			vertex.TexCoords = corners[c] * 0.5f + 0.5f;
+			box.vertices.push_back(vertex);
+		}
+		unsigned int quad[6] = { 0, 1, 2, 0, 2, 3 };
+		for (int i = 0; i < 6; ++i) {
+			box.indices.push_back(first + quad[i]);
+		}
 	}
+
+	//ɫ1x1
+	TextureImage grey;
+	grey.path = "proxy";
+	grey.width = grey.height = 1;
+	grey.components = 4;
+	grey.pixels.assign(4, 160);
+	grey.pixels[3] = 255;
+	BakedTextureLevel level = { 1, 1, 0, 4 };
+	grey.levels.push_back(level);
+
+	Texture texture;
+	texture.id = 0;
+	texture.type = "texture_diffuse";
+	texture.path = grey.path;
+	box.textures.push_back(texture);
+
+	ModelData data;
+	data.directory = "resources/models/turningTool";
+	data.meshes.push_back(box);
+	data.images[grey.path] = std::move(grey);
+	return data;
 }
 
 
-unsigned int loadTexture(char const * path)
+int warmTextureCache()
 {
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
+	//ʱһ·ͷת,򻺴ļԲ
+	vector<pair<string, bool>> sources;
+	sources.push_back(make_pair(string(BACKGROUND_PATH), true));
+	for (unsigned int type = 0; type < PBR_TYPES; ++type) {
+		for (unsigned int m = 0; m < MaterialLibrary::SOURCE_COUNT; ++m) {
+			sources.push_back(make_pair(MaterialLibrary::texturePath(PBR_DIR, PBRtypes[type], (MaterialLibrary::Source)m), true));
+		}
+	}
+	vector<string> modelTextures = listModelTextures(TOOL_MODEL_PATH);
+	for (unsigned int i = 0; i < modelTextures.size(); ++i) {
+		sources.push_back(make_pair(modelTextures[i], false));
+	}
 
-	int width, height, nrComponents;
-	stbi_set_flip_vertically_on_load(true);
-	unsigned char *data = stbi_load(path, &width, &height, &nrComponents, 0);
-	if (data)
-	{
-		GLenum format;
-		if (nrComponents == 1)
-			format = GL_RED;
-		else if (nrComponents == 3)
-			format = GL_RGB;
-		else if (nrComponents == 4)
-			format = GL_RGBA;
-
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		stbi_image_free(data);
+	ThreadPool pool;
+	vector<future<bool>> results;
+	for (unsigned int i = 0; i < sources.size(); ++i) {
+		pair<string, bool> source = sources[i];
+		results.push_back(pool.enqueue([source] { return loadTextureImage(source.first, source.second).valid(); }));
 	}
-	else
-	{
-		std::cout << "Texture failed to load at path: " << path << std::endl;
-		stbi_image_free(data);
+	int failed = 0;
+	for (unsigned int i = 0; i < results.size(); ++i) {
+		if (!results[i].get()) {
+			cout << "Texture failed to load at path: " << sources[i].first << endl;
+			failed++;
+		}
 	}
-	stbi_set_flip_vertically_on_load(false);
-	return textureID;
+	cout << "Texture cache warmed: " << sources.size() - failed << "/" << sources.size() << " textures in " << BAKED_TEXTURE_DIR << endl;
+	return failed == 0 ? 0 : 1;
 }
 
 
@@ -744,68 +1035,82 @@ void initCylinder() {
 	for (int i = 0; i <= stacks; ++i) {
 		radiusMinArray.push_back(0);  //ʼʱ,뾶Сȡ0
 	}
+	cutArray.assign(stacks + 1, 0);
+	stockLod.reset(new StockLod(slices, stacks, radiusStep, cylinderRadius, cylinderLength));
 
 	float R, alpha, x, y, z, texX, texY;
-
-	for (int i = 0; i <= slices; i++) {
-		for (int j = 0; j <= stacks; j++) {
-			R = radiusArray[j] * radiusStep;
-			alpha = i * angleStep;
-			x = R * (float)glm::cos(glm::radians(alpha));
-			y = R * (float)glm::sin(glm::radians(alpha));
-			z = lengthStep * j;
-			texX = (float)i / (float)slices;  //
-			texY = (float)j / (float)stacks;
-
-			//
-			glm::vec3 V(x, y, z);
-
-			//
-			allPoints.push_back(V);
-			allPoints.push_back(glm::vec3(V.x, V.y, 0.0f)); //
-			allPoints.push_back(glm::vec3(texX, texY, 0.0f));//2d+Ƿ(0Ϊ,1Ϊ)
-
-
-			//
-			if (i < slices && j < stacks) {
-				unsigned int leftDown, leftUp, rightDown, rightUp;
-				leftDown = i * (stacks + 1) + j;
-				leftUp = i * (stacks + 1) + (j + 1);
-				rightDown = (i + 1) * (stacks + 1) + j;
-				rightUp = (i + 1) * (stacks + 1) + (j + 1);
-
-				indices.push_back(leftDown);
-				indices.push_back(leftUp);
-				indices.push_back(rightUp);
-				indices.push_back(leftDown);
-				indices.push_back(rightUp);
-				indices.push_back(rightDown);
+	vector<StockSurface> surfaces;  //ֻϴһ
+	stockPositions.assign(stockLod->vertexCount(), StockPosition(0));
+	surfaces.resize(stockLod->vertexCount());
+
+	//水ֿ(stock_lod.h),ÿԼһζ,߽ϵĲһ
+	for (unsigned int c = 0; c < stockLod->chunkCount(); c++) {
+		for (int i = 0; i <= slices; i++) {
+			for (int j = stockLod->chunkFirstStack(c); j <= stockLod->chunkLastStack(c); j++) {
+				R = radiusArray[j] * radiusStep;
+				alpha = i * angleStep;
+				x = R * (float)glm::cos(glm::radians(alpha));
+				y = R * (float)glm::sin(glm::radians(alpha));
+				z = lengthStep * j;
+				texX = (float)i / (float)slices;  //
+				texY = (float)j / (float)stacks;
+
+				//
+				glm::vec3 V(x, y, z);
+
+				//:λúǷ(ʼʱδ),2d
+				unsigned int v = stockLod->vertex(c, i, j);
+				stockPositions[v] = packStockPosition(V, false, cylinderRadius, cylinderLength);
+				surfaces[v] = packStockSurface(glm::vec3(V.x, V.y, 0.0f), glm::vec2(texX, texY));
 			}
 		}
 	}
 
-	vertexNum = indices.size();
+	//:ĺԲϵĶ,z,갴ƽͶӰ
+	for (unsigned int end = 0; end < 2; ++end) {
+		glm::vec3 normal(0.0f, 0.0f, end == 0 ? -1.0f : 1.0f);
+		surfaces[stockLod->capVertex(end, -1)] = packStockSurface(normal, glm::vec2(0.5f, 0.5f));
+		for (int i = 0; i <= slices; i++) {
+			alpha = i * angleStep;
+			glm::vec2 rim((float)glm::cos(glm::radians(alpha)), (float)glm::sin(glm::radians(alpha)));
+			surfaces[stockLod->capVertex(end, i)] = packStockSurface(normal, rim * 0.5f + 0.5f);
+		}
+		packStockCap(end);
+	}
 
-	unsigned int VAO, VBO, EBO;
+	//ϸڲΰǰİ뾶,п鹲һ
+	//ѹĶʽ(stock_vertex.h):ÿ16ֽ,λúͷ/,ʱֻдλ
+	unsigned int VAO, VBO, surfaceVBO;
 	glGenVertexArrays(1, &VAO);
 	glGenBuffers(1, &VBO);
-	glGenBuffers(1, &EBO);
-	glBindVertexArray(VAO);
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(float)*allPoints.size() * 3, &allPoints[0], GL_STREAM_DRAW);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int)*vertexNum, &indices[0], GL_STATIC_DRAW);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 9 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 9 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 9 * sizeof(float), (void*)(6 * sizeof(float)));
-	glEnableVertexAttribArray(2);
-	glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, 9 * sizeof(float), (void*)(8 * sizeof(float)));
-	glEnableVertexAttribArray(3);
+	glGenBuffers(1, &surfaceVBO);
+	glState().bindVertexArray(VAO);
+	glState().bindBuffer(GL_ARRAY_BUFFER, VBO);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(StockPosition)*stockPositions.size(), &stockPositions[0], GL_DYNAMIC_DRAW);
+	glState().bindBuffer(GL_ARRAY_BUFFER, surfaceVBO);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(StockSurface)*surfaces.size(), &surfaces[0], GL_STATIC_DRAW);
+	setupStockAttributes(VBO, surfaceVBO);
 
 	cylinderVAO = VAO;
 	cylinderVBO = VBO;
+	cylinderSurfaceVBO = surfaceVBO;
+}
+
+
+void packStockCap(unsigned int end) {
+	int slices = 360 / angleStep;
+	int stacks = cylinderLength / lengthStep;
+	int stack = end == 0 ? 0 : stacks;
+	float R = radiusArray[stack] * radiusStep;
+	float z = lengthStep * stack;
+	bool cut = cutArray[stack] != 0;
+
+	stockPositions[stockLod->capVertex(end, -1)] = packStockPosition(glm::vec3(0.0f, 0.0f, z), cut, cylinderRadius, cylinderLength);
+	for (int i = 0; i <= slices; i++) {
+		float alpha = i * angleStep;
+		glm::vec3 rim(R * (float)glm::cos(glm::radians(alpha)), R * (float)glm::sin(glm::radians(alpha)), z);
+		stockPositions[stockLod->capVertex(end, i)] = packStockPosition(rim, cut, cylinderRadius, cylinderLength);
+	}
 }
 
 
@@ -0,0 +1,158 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// A read-only memory mapping of a whole file. The mapping stays valid until close() or destruction,
+// so data() can be handed straight to glTexImage2D / glBufferData without an intermediate copy.
+class MappedFile
+{
+public:
+	MappedFile() : bytes(NULL), length(0)
+#ifdef _WIN32
+		, fileHandle(INVALID_HANDLE_VALUE), mappingHandle(NULL)
+#endif
+	{
+	}
+
+	~MappedFile()
+	{
+		close();
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	MappedFile(MappedFile &&other) : MappedFile()
+	{
+		swap(other);
+	}
+
+	MappedFile& operator=(MappedFile &&other)
+	{
+		if (this != &other)
+		{
+			close();
+			swap(other);
+		}
+		return *this;
+	}
+
+	// maps the file at path, returns false if it doesn't exist or is empty
+	// ------------------------------------------------------------------------
+	bool open(const std::string &path)
+	{
+		close();
+#ifdef _WIN32
+		fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (fileHandle == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0)
+		{
+			close();
+			return false;
+		}
+		mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mappingHandle == NULL)
+		{
+			close();
+			return false;
+		}
+		bytes = (const unsigned char*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+		if (bytes == NULL)
+		{
+			close();
+			return false;
+		}
+		length = (size_t)fileSize.QuadPart;
+#else
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat info;
+		if (fstat(fd, &info) != 0 || info.st_size == 0)
+		{
+			::close(fd);
+			return false;
+		}
+		void *view = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);  // the mapping keeps its own reference to the file
+		if (view == MAP_FAILED)
+			return false;
+		bytes = (const unsigned char*)view;
+		length = (size_t)info.st_size;
+#endif
+		return true;
+	}
+
+	void close()
+	{
+#ifdef _WIN32
+		if (bytes != NULL)
+			UnmapViewOfFile(bytes);
+		if (mappingHandle != NULL)
+			CloseHandle(mappingHandle);
+		if (fileHandle != INVALID_HANDLE_VALUE)
+			CloseHandle(fileHandle);
+		mappingHandle = NULL;
+		fileHandle = INVALID_HANDLE_VALUE;
+#else
+		if (bytes != NULL)
+			munmap((void*)bytes, length);
+#endif
+		bytes = NULL;
+		length = 0;
+	}
+
+	bool isOpen() const
+	{
+		return bytes != NULL;
+	}
+
+	const unsigned char* data() const
+	{
+		return bytes;
+	}
+
+	size_t size() const
+	{
+		return length;
+	}
+
+private:
+	const unsigned char *bytes;
+	size_t length;
+#ifdef _WIN32
+	HANDLE fileHandle;
+	HANDLE mappingHandle;
+#endif
+
+	void swap(MappedFile &other)
+	{
+		std::swap(bytes, other.bytes);
+		std::swap(length, other.length);
+#ifdef _WIN32
+		std::swap(fileHandle, other.fileHandle);
+		std::swap(mappingHandle, other.mappingHandle);
+#endif
+	}
+};
+#endif
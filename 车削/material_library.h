@@ -0,0 +1,373 @@
+#ifndef MATERIAL_LIBRARY_H
+#define MATERIAL_LIBRARY_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_precision.hpp>
+
+#include "baked_texture.h"
+#include "texture_streamer.h"
+#include "gl_state.h"
+
+#include <string>
+#include <vector>
+using namespace std;
+
+// The PBR material sets (albedo, normal, metallic, roughness and ao maps in resources/textures/pbr/<name>)
+// loaded on demand into texture arrays. Every set is resampled to one layer size and packed into three
+// maps: albedo, normal and ORM (r: ao, g: roughness, b: metallic). Each map is a GL_TEXTURE_2D_ARRAY
+// whose layers are slots: layer 0 holds the placeholder colours, the others hold whichever sets are
+// resident. A shader picks a set by its layer, so any number of sets costs three samplers and three binds.
+// With compression on, the layers are block compressed on the worker as they are built: albedo and ORM as
+// BC1, normal as BC5 (x and y only, the shader rebuilds z), a sixth of the plain size.
+//
+// The memory budget decides how many slots there are. A set is requested from the TextureStreamer the
+// first time it is used; when no slot is free the least recently used set that isn't needed this frame
+// gives up its slot. Sets that are likely to be needed next can be prefetched into free slots.
+class MaterialLibrary
+{
+public:
+	enum Map { ALBEDO, NORMAL, ORM, MAP_COUNT };
+	enum Source { ALBEDO_SOURCE, NORMAL_SOURCE, AO_SOURCE, ROUGHNESS_SOURCE, METALLIC_SOURCE, SOURCE_COUNT };
+
+	static const unsigned int COMPONENTS = 3;
+
+	MaterialLibrary(TextureStreamer &streamer, const string &directory, const vector<string> &names, int layerSize, size_t budgetBytes,
+		bool compressed = false)
+		: streamer(streamer), directory(directory), layerSize(layerSize), compressed(compressed), frame(0)
+	{
+		materials.resize(names.size());
+		for (unsigned int i = 0; i < names.size(); i++)
+			materials[i].name = names[i];
+
+		// two slots at least, the base and the cut set are always needed together
+		size_t slots = std::max<size_t>(budgetBytes / slotBytes(layerSize, compressed), 2);
+		slots = std::min<size_t>(slots, names.size());
+		GLint maxLayers;
+		glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+		slots = std::min<size_t>(slots, (size_t)maxLayers - 1);
+		slotOwners.assign(slots + 1, -1);
+		createArrays();
+	}
+
+	~MaterialLibrary()
+	{
+		for (unsigned int i = 0; i < materials.size(); i++)
+			for (unsigned int m = 0; m < MAP_COUNT; m++)
+				streamer.cancel(&materials[i].tickets[m]);
+		glState().deleteTextures(MAP_COUNT, arrays);
+	}
+
+	MaterialLibrary(const MaterialLibrary&) = delete;
+	MaterialLibrary& operator=(const MaterialLibrary&) = delete;
+
+	static const char* sourceName(Source source)
+	{
+		static const char *names[SOURCE_COUNT] = { "albedo", "normal", "ao", "roughness", "metallic" };
+		return names[source];
+	}
+
+	// the colour a map shows until its set is in: grey albedo, flat normal, no occlusion, rough, dielectric
+	static glm::u8vec4 placeholderColor(Map map)
+	{
+		static const glm::u8vec4 colors[MAP_COUNT] = {
+			glm::u8vec4(128, 128, 128, 255), glm::u8vec4(128, 128, 255, 255), glm::u8vec4(255, 255, 0, 255)
+		};
+		return colors[map];
+	}
+
+	static string texturePath(const string &directory, const string &name, Source source)
+	{
+		return directory + "/" + name + "/" + sourceName(source) + ".png";
+	}
+
+	// the compressed format of a map's array, 0 for plain rgb
+	static GLenum layerFormat(Map map, bool compressed)
+	{
+		if (!compressed)
+			return 0;
+		return map == NORMAL ? GL_COMPRESSED_RG_RGTC2 : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	}
+
+	// GPU memory of one slot: all three maps with their mip chains, counting rgb as 4 bytes like drivers store it
+	static size_t slotBytes(int layerSize, bool compressed)
+	{
+		size_t bytes = 0;
+		for (unsigned int m = 0; m < MAP_COUNT; m++)
+		{
+			GLenum format = layerFormat((Map)m, compressed);
+			for (int size = layerSize; ; size = std::max(size / 2, 1))
+			{
+				bytes += format != 0 ? (size_t)compressedLevelBytes(format, size, size) : (size_t)size * size * 4;
+				if (size == 1)
+					break;
+			}
+		}
+		return bytes;
+	}
+
+	// builds one layer of a map on a worker: the sources are resampled to the layer size, packed into
+	// rgb and given a fresh mip chain, then compressed into format unless it is 0. Channels whose source
+	// is missing keep the placeholder colour. no OpenGL calls.
+	// ------------------------------------------------------------------------
+	static TextureImage loadLayerImage(const string &directory, const string &name, Map map, int layerSize, GLenum format)
+	{
+		TextureImage layer;
+		allocateMipChain(layer, layerSize, layerSize, COMPONENTS);
+		layer.path = directory + "/" + name;
+		unsigned char *pixels = layer.pixels.data();
+		glm::u8vec4 color = placeholderColor(map);
+		for (size_t i = 0; i < (size_t)layerSize * layerSize; i++)
+			for (unsigned int c = 0; c < COMPONENTS; c++)
+				pixels[i * COMPONENTS + c] = color[c];
+
+		// where each source lands: first channel in the layer and how many channels it fills
+		Source sources[COMPONENTS];
+		unsigned int count;
+		if (map == ORM)
+		{
+			sources[0] = AO_SOURCE;
+			sources[1] = ROUGHNESS_SOURCE;
+			sources[2] = METALLIC_SOURCE;
+			count = 3;
+		}
+		else
+		{
+			sources[0] = map == ALBEDO ? ALBEDO_SOURCE : NORMAL_SOURCE;
+			count = 1;
+		}
+		for (unsigned int s = 0; s < count; s++)
+		{
+			TextureImage image = loadTextureImage(texturePath(directory, name, sources[s]), true);
+			if (!image.valid())
+			{
+				cout << "Texture failed to load at path: " << image.path << endl;
+				continue;
+			}
+			unsigned int level = closestLevel(image, layerSize, layerSize);
+			int channels = count == 1 ? COMPONENTS : 1;
+			resampleChannels(image.levelData(level), image.levels[level].width, image.levels[level].height, image.components, 0,
+				pixels, layerSize, layerSize, COMPONENTS, s, channels);
+		}
+		generateMipChain(layer);
+		if (format != 0)
+			return compressTextureImage(layer, format);
+		return layer;
+	}
+
+	// marks a set as needed this frame, requesting it if it isn't loaded yet
+	// ------------------------------------------------------------------------
+	void use(unsigned int index)
+	{
+		Material &material = materials[index];
+		material.lastUsed = frame;
+		if (material.slot < 0)
+		{
+			int slot = freeSlot();
+			if (slot < 0)
+				slot = evictLeastRecentlyUsed();
+			if (slot >= 0)
+				load(index, slot);  // otherwise every slot is in use this frame, try again next frame
+		}
+	}
+
+	// starts loading a set in the background if a slot is free; never evicts anything
+	// ------------------------------------------------------------------------
+	void prefetch(unsigned int index)
+	{
+		Material &material = materials[index];
+		if (material.slot >= 0 || streamer.busy())
+			return;
+		int slot = freeSlot();
+		if (slot < 0)
+			return;
+		load(index, slot);
+		material.lastUsed = frame > 0 ? frame - 1 : 0;  // older than anything in use right now
+	}
+
+	// once per frame after the streamer has run: marks the sets whose layers are all in as resident
+	// ------------------------------------------------------------------------
+	void update()
+	{
+		for (unsigned int i = 0; i < materials.size(); i++)
+		{
+			Material &material = materials[i];
+			if (material.state != LOADING)
+				continue;
+			bool done = true;
+			for (unsigned int m = 0; m < MAP_COUNT; m++)
+				done = done && !streamer.pending(&material.tickets[m]);
+			if (done)
+				material.state = RESIDENT;
+		}
+		frame++;
+	}
+
+	// the texture array holding map for every set
+	unsigned int texture(Map map) const
+	{
+		return arrays[map];
+	}
+
+	// the layer to sample for a set: its slot once it is resident, the placeholder layer until then
+	float layer(unsigned int index) const
+	{
+		const Material &material = materials[index];
+		return material.state == RESIDENT ? (float)material.slot : 0.0f;
+	}
+
+	bool isResident(unsigned int index) const
+	{
+		return materials[index].state == RESIDENT;
+	}
+
+	unsigned int size() const
+	{
+		return (unsigned int)materials.size();
+	}
+
+	const string& name(unsigned int index) const
+	{
+		return materials[index].name;
+	}
+
+	// number of sets that can be resident at once
+	unsigned int slots() const
+	{
+		return (unsigned int)slotOwners.size() - 1;
+	}
+
+	// GPU memory of the texture arrays
+	size_t residentBytes() const
+	{
+		return slotBytes(layerSize, compressed) * slotOwners.size();
+	}
+
+private:
+	enum State { UNLOADED, LOADING, RESIDENT };
+
+	struct Material {
+		string name;
+		unsigned int tickets[MAP_COUNT];	// keys of the streamer requests filling the layers
+		State state;
+		int slot;
+		unsigned long long lastUsed;
+
+		Material() : state(UNLOADED), slot(-1), lastUsed(0) {}
+	};
+
+	TextureStreamer &streamer;
+	string directory;
+	vector<Material> materials;
+	vector<int> slotOwners;		// layer -> material in it, -1 if free; layer 0 is the placeholder
+	unsigned int arrays[MAP_COUNT];
+	int layerSize;
+	bool compressed;
+	unsigned long long frame;
+
+	void createArrays()
+	{
+		GLsizei layers = (GLsizei)slotOwners.size();
+		glGenTextures(MAP_COUNT, arrays);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for (unsigned int m = 0; m < MAP_COUNT; m++)
+		{
+			GLenum format = layerFormat((Map)m, compressed);
+			glState().bindTexture(GL_TEXTURE_2D_ARRAY, arrays[m]);
+
+			// the placeholder layer is one colour on every level, so one pixel or block repeated fills it
+			glm::u8vec4 color = placeholderColor((Map)m);
+			vector<unsigned char> unit(COMPONENTS);
+			for (unsigned int c = 0; c < COMPONENTS; c++)
+				unit[c] = color[c];
+			if (format != 0)
+			{
+				unsigned char pixels[16 * COMPONENTS];
+				for (unsigned int i = 0; i < 16 * COMPONENTS; i++)
+					pixels[i] = color[i % COMPONENTS];
+				unit.resize(compressedBlockBytes(format));
+				compressLevel(pixels, 4, 4, COMPONENTS, format, unit.data());
+			}
+			size_t levelBytes = format != 0 ? (size_t)compressedLevelBytes(format, layerSize, layerSize) : (size_t)layerSize * layerSize * COMPONENTS;
+			vector<unsigned char> fill(levelBytes);
+			for (size_t i = 0; i < fill.size(); i++)
+				fill[i] = unit[i % unit.size()];
+
+			GLint levels = 0;
+			for (int size = layerSize; ; size = std::max(size / 2, 1))
+			{
+				if (format != 0)
+				{
+					GLsizei bytes = (GLsizei)compressedLevelBytes(format, size, size);
+					glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, levels, format, size, size, layers, 0, bytes * layers, NULL);
+					glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, levels, 0, 0, 0, size, size, 1, format, bytes, fill.data());
+				}
+				else
+				{
+					glTexImage3D(GL_TEXTURE_2D_ARRAY, levels, GL_RGB8, size, size, layers, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+					glTexSubImage3D(GL_TEXTURE_2D_ARRAY, levels, 0, 0, 0, size, size, 1, GL_RGB, GL_UNSIGNED_BYTE, fill.data());
+				}
+				levels++;
+				if (size == 1)
+					break;
+			}
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glState().bindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	}
+
+	int freeSlot() const
+	{
+		for (unsigned int slot = 1; slot < slotOwners.size(); slot++)
+			if (slotOwners[slot] < 0)
+				return (int)slot;
+		return -1;
+	}
+
+	// frees the slot of the least recently used set that wasn't used this frame, -1 if there is none
+	int evictLeastRecentlyUsed()
+	{
+		int victim = -1;
+		for (unsigned int i = 0; i < materials.size(); i++)
+		{
+			const Material &material = materials[i];
+			if (material.slot < 0 || material.lastUsed == frame)
+				continue;
+			if (victim < 0 || material.lastUsed < materials[victim].lastUsed)
+				victim = i;
+		}
+		if (victim < 0)
+			return -1;
+		Material &material = materials[victim];
+		int slot = material.slot;
+		for (unsigned int m = 0; m < MAP_COUNT; m++)
+			streamer.cancel(&material.tickets[m]);
+		slotOwners[slot] = -1;
+		material.slot = -1;
+		material.state = UNLOADED;
+		return slot;
+	}
+
+	void load(unsigned int index, int slot)
+	{
+		Material &material = materials[index];
+		slotOwners[slot] = (int)index;
+		material.slot = slot;
+		material.state = LOADING;
+		for (unsigned int m = 0; m < MAP_COUNT; m++)
+		{
+			string dir = directory, name = material.name;
+			Map map = (Map)m;
+			int size = layerSize;
+			GLenum format = layerFormat(map, compressed);
+			streamer.requestLayer(&material.tickets[m], arrays[m], (unsigned int)slot,
+				[dir, name, map, size, format] { return loadLayerImage(dir, name, map, size, format); });
+		}
+	}
+};
+#endif
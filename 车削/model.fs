@@ -2,10 +2,12 @@
 out vec4 FragColor;
 
 in vec2 TexCoords;
+flat in float Material;
 
-uniform sampler2D texture_diffuse1;
+//ģ͵ϲһλ,ÿֲеһ
+uniform sampler2DArray texture_diffuse1;
 
 void main()
 {    
-    FragColor = texture(texture_diffuse1, TexCoords);
+    FragColor = texture(texture_diffuse1, vec3(TexCoords, Material));
 }
\ No newline at end of file
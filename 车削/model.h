@@ -5,12 +5,15 @@
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
-#include "stb_image.h"
+#include "baked_texture.h"
+#include "baked_mesh.h"
+#include "texture_cache.h"
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
 #include "mesh.h"
+#include "model_batch.h"
 #include "shader.h"
 
 #include <string>
@@ -18,55 +21,137 @@
 #include <sstream>
 #include <iostream>
 #include <map>
+#include <algorithm>
+#include <memory>
 #include <vector>
 using namespace std;
 
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false);
+unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false, bool compressed = false);
+vector<string> listModelTextures(string const &path);
 
+// the post-processing every model import runs; part of the baked mesh key
+const unsigned int MODEL_IMPORT_FLAGS = aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace;
+
+// The meshes are baked into one ModelBatch, so the model is a single draw however many meshes it has;
+// shaders drawing it read the material textures as sampler2DArray (see ModelBatch).
 class Model
 {
 public:
 	// model data 
-	vector<Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
-	vector<Mesh>    meshes;
+	vector<MeshData> meshes;	// the CPU side geometry and texture paths of every mesh, empty without keepGeometry
 	string directory;
 	bool gammaCorrection;
+	bool keepGeometry;	// false: the geometry is dropped once uploaded
 
 	// constructor, expects a filepath to a 3D model.
-	Model(string const &path, bool gamma = false) : gammaCorrection(gamma)
+	Model(string const &path, bool gamma = false, bool keepGeometry = true) : gammaCorrection(gamma), keepGeometry(keepGeometry)
 	{
-		loadModel(path);
+		ModelData data = importModel(path);
+		build(data);
 	}
 
-	// draws the model, and thus all its meshes
-	void Draw(Shader &shader)
+	// constructor, uploads a model that was imported earlier (usually on another thread).
+	// the geometry is moved out of data.
+	explicit Model(ModelData &data, bool gamma = false, bool keepGeometry = true) : gammaCorrection(gamma), keepGeometry(keepGeometry)
 	{
-		for (unsigned int i = 0; i < meshes.size(); i++)
-			meshes[i].Draw(shader);
+		build(data);
 	}
 
-private:
-	// loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
-	void loadModel(string const &path)
+	Model(const Model&) = delete;
+	Model& operator=(const Model&) = delete;
+
+	unsigned int meshCount() const { return (unsigned int)batch->drawRanges().size(); }
+	unsigned int materialCount() const { return batch->materialCount(); }
+
+	// reads the model file via ASSIMP and decodes its textures, without creating any OpenGL objects.
+	// the meshes come from the baked mesh cache when it is up to date, so assimp only runs on the first
+	// import of a file. with compressed set, textures that have been transcoded are loaded block compressed.
+	static ModelData importModel(string const &path, bool compressed = false)
 	{
-		// read file via ASSIMP
-		Assimp::Importer importer;
-		const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
-		// check for errors
-		if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
+		ModelData data;
+		data.compressed = compressed;
+		// retrieve the directory path of the filepath
+		data.directory = path.substr(0, path.find_last_of('/'));
+		if (!openBakedMesh(path, MODEL_IMPORT_FLAGS, data))
 		{
-			cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
-			return;
+			// read file via ASSIMP
+			Assimp::Importer importer;
+			const aiScene* scene = importer.ReadFile(path, MODEL_IMPORT_FLAGS);
+			// check for errors
+			if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
+			{
+				cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
+				data.directory.clear();
+				return data;
+			}
+
+			// process ASSIMP's root node recursively
+			processNode(scene->mRootNode, scene, data);
+			writeBakedMesh(path, MODEL_IMPORT_FLAGS, data);
 		}
-		// retrieve the directory path of the filepath
-		directory = path.substr(0, path.find_last_of('/'));
 
-		// process ASSIMP's root node recursively
-		processNode(scene->mRootNode, scene);
+		// decode every texture the materials refer to once, unless another model has it loaded already
+		TextureCache &cache = TextureCache::instance();
+		for (unsigned int i = 0; i < data.meshes.size(); i++)
+		{
+			for (unsigned int j = 0; j < data.meshes[i].textures.size(); j++)
+			{
+				const string &file = data.meshes[i].textures[j].path;
+				string source = data.directory + '/' + file;
+				if (data.images.find(file) == data.images.end() && !cache.contains(source, false, compressed))
+					data.images[file] = loadTextureImage(source, false, compressed);
+			}
+		}
+		return data;
+	}
+
+	// draws the model, and thus all its meshes; the samplers already point at their units (see bindMaterialSamplers)
+	void Draw()
+	{
+		batch->Draw();
+	}
+
+private:
+	unique_ptr<ModelBatch> batch;
+
+	// creates the OpenGL objects for the imported meshes and textures
+	void build(ModelData &data)
+	{
+		directory = data.directory;
+		vector<unsigned int> references;
+		for (unsigned int i = 0; i < data.meshes.size(); i++)
+			for (unsigned int j = 0; j < data.meshes[i].textures.size(); j++)
+				references.push_back(loadTexture(data.meshes[i].textures[j], data));
+		// uploaded straight from wherever the geometry is, the mapping or the importer's vectors
+		batch.reset(new ModelBatch(data.meshes));
+		// the arrays hold the textures now. keeping the 2D ones as well would double the model's texture
+		// memory, so the cache frees those no other model holds. a later model using the same file shares
+		// it by content if it is still loaded, or reloads it cheaply from the baked texture cache
+		for (unsigned int i = 0; i < references.size(); i++)
+			TextureCache::instance().release(references[i]);
+
+		if (!keepGeometry)
+			return;
+		for (unsigned int i = 0; i < data.meshes.size(); i++)
+		{
+			MeshData &mesh = data.meshes[i];
+			for (unsigned int j = 0; j < mesh.textures.size(); j++)
+				mesh.textures[j].id = 0;	// released above
+			if (mesh.mappedVertices)
+			{
+				// keeping it means owning it, so this is the one place a mapped mesh is copied
+				mesh.vertices.assign(mesh.mappedVertices, mesh.mappedVertices + mesh.mappedVertexCount);
+				mesh.indices.assign(mesh.mappedIndices, mesh.mappedIndices + mesh.mappedIndexCount);
+				mesh.mappedVertices = NULL;
+				mesh.mappedIndices = NULL;
+				mesh.mappedVertexCount = mesh.mappedIndexCount = 0;
+			}
+		}
+		meshes = std::move(data.meshes);
 	}
 
 	// processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-	void processNode(aiNode *node, const aiScene *scene)
+	static void processNode(aiNode *node, const aiScene *scene, ModelData &data)
 	{
 		// process each mesh located at the current node
 		for (unsigned int i = 0; i < node->mNumMeshes; i++)
@@ -74,22 +159,23 @@ private:
 			// the node object only contains indices to index the actual objects in the scene. 
 			// the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
 			aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-			meshes.push_back(processMesh(mesh, scene));
+			data.meshes.push_back(processMesh(mesh, scene));
 		}
 		// after we've processed all of the meshes (if any) we then recursively process each of the children nodes
 		for (unsigned int i = 0; i < node->mNumChildren; i++)
 		{
-			processNode(node->mChildren[i], scene);
+			processNode(node->mChildren[i], scene, data);
 		}
 
 	}
 
-	Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+	static MeshData processMesh(aiMesh *mesh, const aiScene *scene)
 	{
 		// data to fill
-		vector<Vertex> vertices;
-		vector<unsigned int> indices;
-		vector<Texture> textures;
+		MeshData data;
+		vector<Vertex> &vertices = data.vertices;
+		vector<unsigned int> &indices = data.indices;
+		vector<Texture> &textures = data.textures;
 
 		// walk through each of the mesh's vertices
 		for (unsigned int i = 0; i < mesh->mNumVertices; i++)
@@ -164,82 +250,93 @@ private:
 		std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
 		textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
 
-		// return a mesh object created from the extracted mesh data
-		return Mesh(vertices, indices, textures);
+		// return the extracted mesh data, the Mesh object is created later on the GL thread
+		return data;
 	}
 
-	// checks all material textures of a given type and loads the textures if they're not loaded yet.
-	// the required info is returned as a Texture struct.
-	vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName)
+	// collects all material textures of a given type. Only the type and path are filled in here,
+	// the textures themselves are loaded in build().
+	static vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName)
 	{
 		vector<Texture> textures;
 		for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
 		{
 			aiString str;
 			mat->GetTexture(type, i, &str);
-			// check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-			bool skip = false;
-			for (unsigned int j = 0; j < textures_loaded.size(); j++)
-			{
-				if (std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-				{
-					textures.push_back(textures_loaded[j]);
-					skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-					break;
-				}
-			}
-			if (!skip)
-			{   // if texture hasn't been loaded already, load it
-				Texture texture;
-				texture.id = TextureFromFile(str.C_Str(), this->directory);
-				texture.type = typeName;
-				texture.path = str.C_Str();
-				textures.push_back(texture);
-				textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
-			}
+			Texture texture;
+			texture.id = 0;
+			texture.type = typeName;
+			texture.path = str.C_Str();
+			textures.push_back(texture);
 		}
 		return textures;
 	}
+
+	// fills in texture.id and takes a reference to it in the TextureCache, uploading the texture only if
+	// no model has loaded it yet. returns the id, for the caller to release.
+	unsigned int loadTexture(Texture &texture, ModelData &data)
+	{
+		TextureCache &cache = TextureCache::instance();
+		string source = directory + '/' + texture.path;
+		texture.id = cache.acquire(source, false, data.compressed);
+		if (texture.id == 0)
+		{
+			// upload the image decoded during the import. it can be missing if the import skipped it as cached
+			// and the texture was released since, then it's loaded here after all
+			map<string, TextureImage>::iterator image = data.images.find(texture.path);
+			if (image != data.images.end())
+				texture.id = cache.insert(source, false, data.compressed, image->second);
+			else
+				texture.id = TextureFromFile(texture.path.c_str(), this->directory, gammaCorrection, data.compressed);
+		}
+		return texture.id;
+	}
 };
 
 
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma)
+unsigned int TextureFromFile(const char *path, const string &directory, bool gamma, bool compressed)
 {
 	string filename = string(path);
 	filename = directory + '/' + filename;
 
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
+	// shared with every other model that loaded the same file, the caller owns one reference
+	TextureCache &cache = TextureCache::instance();
+	unsigned int textureID = cache.acquire(filename, false, compressed);
+	if (textureID != 0)
+		return textureID;
+	// the baked cache holds the decoded image and all its mip levels, so there's no glGenerateMipmap here.
+	// a transcoded, block compressed version is used if there is one and the context can sample it
+	return cache.insert(filename, false, compressed, loadTextureImage(filename, false, compressed && compressedTexturesSupported()));
+}
 
-	int width, height, nrComponents;
-	unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-	if (data)
+// lists the texture files a model's materials refer to, without creating any OpenGL objects.
+// used to pre-warm the texture cache.
+vector<string> listModelTextures(string const &path)
+{
+	vector<string> files;
+	Assimp::Importer importer;
+	const aiScene* scene = importer.ReadFile(path, 0);
+	if (!scene || !scene->mRootNode)
 	{
-		GLenum format;
-		if (nrComponents == 1)
-			format = GL_RED;
-		else if (nrComponents == 3)
-			format = GL_RGB;
-		else if (nrComponents == 4)
-			format = GL_RGBA;
-
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		stbi_image_free(data);
+		cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
+		return files;
 	}
-	else
+	string directory = path.substr(0, path.find_last_of('/'));
+	const aiTextureType types[] = { aiTextureType_DIFFUSE, aiTextureType_SPECULAR, aiTextureType_HEIGHT, aiTextureType_AMBIENT };
+	for (unsigned int m = 0; m < scene->mNumMaterials; m++)
 	{
-		std::cout << "Texture failed to load at path: " << path << std::endl;
-		stbi_image_free(data);
+		for (unsigned int t = 0; t < sizeof(types) / sizeof(types[0]); t++)
+		{
+			for (unsigned int i = 0; i < scene->mMaterials[m]->GetTextureCount(types[t]); i++)
+			{
+				aiString str;
+				scene->mMaterials[m]->GetTexture(types[t], i, &str);
+				string file = directory + '/' + str.C_Str();
+				if (find(files.begin(), files.end(), file) == files.end())
+					files.push_back(file);
+			}
+		}
 	}
-
-	return textureID;
+	return files;
 }
 #endif
\ No newline at end of file
@@ -2,13 +2,20 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
+layout (location = 5) in float aMaterial;  //Ĳ,Ĳ
 
 out vec2 TexCoords;
+flat out float Material;
 
-uniform mat4 model;
+//ÿλƵı任(std140,main.cppеDrawTransformһ),߾CPU
+layout (std140) uniform DrawTransform {
+    mat4 model;
+    mat3 normalMatrix;  //transpose(inverse(mat3(model)))
+};
 
 void main()
 {
     TexCoords = aTexCoords;    
+    Material = aMaterial;
     gl_Position =  model * vec4(aPos, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,404 @@
+#ifndef MODEL_BATCH_H
+#define MODEL_BATCH_H
+
+#include <glad/glad.h>
+
+#include "baked_mesh.h"
+#include "block_compression.h"
+#include "gl_state.h"
+#include "mesh.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+#include <vector>
+using namespace std;
+
+// All meshes of a model baked into one vertex and one index buffer, drawn with a single
+// glMultiDrawElementsBaseVertex, so the draw calls and binds don't grow with the mesh count. Every mesh
+// keeps its range of the buffers and a material index.
+//
+// A material is a distinct set of textures. For each texture type some material uses there is one
+// GL_TEXTURE_2D_ARRAY with a layer per material, bound to the unit of the type's first sampler (see
+// bindMaterialSamplers), so a shader declares <type>1 as sampler2DArray. GL 3.3 has no gl_DrawID, so the
+// layer comes from a second vertex stream, attribute 5, holding each vertex's material. Only the first
+// texture of each type is kept, and a type a material has no texture of gets a neutral layer. When all
+// textures of a type share one block compressed format and size, their blocks are copied into a
+// compressed array as they are. Otherwise they are drawn into an RGBA8 array the size of the largest,
+// which scales them and decodes the compressed ones. The arrays are copies, so the 2D textures can be
+// released once the batch is built.
+class ModelBatch
+{
+public:
+	static const int MAX_LAYER_SIZE = 2048;
+
+	struct DrawRange {
+		GLsizei count;
+		GLsizei firstIndex;
+		GLint baseVertex;
+		unsigned int material;
+	};
+
+	// meshes' texture ids have to be loaded; nothing of meshes is kept
+	explicit ModelBatch(const vector<MeshData> &meshes)
+	{
+		for (unsigned int type = 0; type < MESH_TEXTURE_TYPE_COUNT; type++)
+			arrays[type] = 0;
+		vector<unsigned int> meshMaterials = assignMaterials(meshes);
+		setupBuffers(meshes, meshMaterials);
+		bakeTextures();
+	}
+
+	~ModelBatch()
+	{
+		for (unsigned int type = 0; type < MESH_TEXTURE_TYPE_COUNT; type++)
+			if (arrays[type] != 0)
+				glState().deleteTextures(1, &arrays[type]);
+		glState().deleteVertexArrays(1, &VAO);
+		glState().deleteBuffers(1, &VBO);
+		glState().deleteBuffers(1, &materialVBO);
+		glState().deleteBuffers(1, &EBO);
+	}
+
+	ModelBatch(const ModelBatch&) = delete;
+	ModelBatch& operator=(const ModelBatch&) = delete;
+
+	// draws every mesh; the samplers already point at their units (see bindMaterialSamplers)
+	// ------------------------------------------------------------------------
+	void Draw()
+	{
+		if (counts.empty())
+			return;
+		for (unsigned int type = 0; type < MESH_TEXTURE_TYPE_COUNT; type++)
+			if (arrays[type] != 0)
+				glState().bindTexture(type * MESH_TEXTURES_PER_TYPE, GL_TEXTURE_2D_ARRAY, arrays[type]);
+		glState().bindVertexArray(VAO);
+		glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts.data(), GL_UNSIGNED_INT, offsets.data(), (GLsizei)counts.size(), baseVertices.data());
+	}
+
+	const vector<DrawRange>& drawRanges() const { return ranges; }
+	unsigned int materialCount() const { return (unsigned int)materials.size(); }
+
+private:
+	GLuint VAO, VBO, materialVBO, EBO;
+	GLuint arrays[MESH_TEXTURE_TYPE_COUNT];	// 0 for types no material has
+	vector<DrawRange> ranges;
+	vector<GLsizei> counts;	// the ranges again, in the form glMultiDrawElementsBaseVertex takes
+	vector<const void*> offsets;
+	vector<GLint> baseVertices;
+	// per material the 2D texture of each type, 0 if it has none
+	vector<vector<GLuint>> materials;
+
+	// collects the distinct texture sets and returns the material of each mesh
+	vector<unsigned int> assignMaterials(const vector<MeshData> &meshes)
+	{
+		vector<unsigned int> meshMaterials(meshes.size());
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			vector<GLuint> textures(MESH_TEXTURE_TYPE_COUNT, 0);
+			for (unsigned int j = 0; j < meshes[i].textures.size(); j++)
+				for (unsigned int type = 0; type < MESH_TEXTURE_TYPE_COUNT; type++)
+					if (meshes[i].textures[j].type == MESH_TEXTURE_TYPES[type] && textures[type] == 0)
+						textures[type] = meshes[i].textures[j].id;
+			vector<vector<GLuint>>::iterator found = find(materials.begin(), materials.end(), textures);
+			meshMaterials[i] = (unsigned int)(found - materials.begin());
+			if (found == materials.end())
+				materials.push_back(textures);
+		}
+		return meshMaterials;
+	}
+
+	// concatenates the meshes; indices stay relative to their mesh, the base vertex offsets them
+	void setupBuffers(const vector<MeshData> &meshes, const vector<unsigned int> &meshMaterials)
+	{
+		size_t vertexTotal = 0, indexTotal = 0;
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			if (meshes[i].indexCount() == 0)
+				continue;
+			DrawRange range = { (GLsizei)meshes[i].indexCount(), (GLsizei)indexTotal, (GLint)vertexTotal, meshMaterials[i] };
+			ranges.push_back(range);
+			counts.push_back(range.count);
+			offsets.push_back((const void*)(indexTotal * sizeof(unsigned int)));
+			baseVertices.push_back(range.baseVertex);
+			vertexTotal += meshes[i].vertexCount();
+			indexTotal += meshes[i].indexCount();
+		}
+
+		glGenVertexArrays(1, &VAO);
+		glGenBuffers(1, &VBO);
+		glGenBuffers(1, &materialVBO);
+		glGenBuffers(1, &EBO);
+		glState().bindVertexArray(VAO);
+
+		// straight from wherever each mesh's geometry is, without assembling a CPU copy first
+		vector<GLushort> vertexMaterials;
+		vertexMaterials.reserve(vertexTotal);
+		glState().bindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBufferData(GL_ARRAY_BUFFER, vertexTotal * sizeof(Vertex), NULL, GL_STATIC_DRAW);
+		glState().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexTotal * sizeof(unsigned int), NULL, GL_STATIC_DRAW);
+		for (unsigned int i = 0, r = 0; i < meshes.size(); i++)
+		{
+			if (meshes[i].indexCount() == 0)
+				continue;
+			const DrawRange &range = ranges[r++];
+			glBufferSubData(GL_ARRAY_BUFFER, range.baseVertex * sizeof(Vertex), meshes[i].vertexCount() * sizeof(Vertex), meshes[i].vertexData());
+			glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, range.firstIndex * sizeof(unsigned int), range.count * sizeof(unsigned int), meshes[i].indexData());
+			vertexMaterials.insert(vertexMaterials.end(), meshes[i].vertexCount(), (GLushort)range.material);
+		}
+
+		// the Vertex attributes, and the material
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+		glEnableVertexAttribArray(3);
+		glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
+		glEnableVertexAttribArray(4);
+		glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+		glState().bindBuffer(GL_ARRAY_BUFFER, materialVBO);
+		glBufferData(GL_ARRAY_BUFFER, vertexMaterials.size() * sizeof(GLushort), vertexMaterials.data(), GL_STATIC_DRAW);
+		glEnableVertexAttribArray(5);
+		glVertexAttribPointer(5, 1, GL_UNSIGNED_SHORT, GL_FALSE, sizeof(GLushort), (void*)0);
+
+		glState().bindVertexArray(0);
+	}
+
+	// the texture units the bake works on. bindTexture(unit, ...) leaves the active unit alone when the
+	// binding is there already, while glTexImage and friends act on the active unit
+	void bindOn(unsigned int unit, GLenum target, GLuint id)
+	{
+		glState().activeTexture(unit);
+		glState().bindTexture(target, id);
+	}
+
+	// one array per texture type in use, each material's texture copied or drawn into its layer
+	// ------------------------------------------------------------------------
+	void bakeTextures()
+	{
+		// what a missing texture of each type stands for: white, no specular, a flat normal, no height
+		const GLfloat neutral[MESH_TEXTURE_TYPE_COUNT][4] = {
+			{ 1.0f, 1.0f, 1.0f, 1.0f }, { 0.0f, 0.0f, 0.0f, 1.0f }, { 0.5f, 0.5f, 1.0f, 1.0f }, { 0.0f, 0.0f, 0.0f, 1.0f } };
+
+		GLuint program = 0, emptyVAO = 0, fbo = 0;
+		GLint viewport[4], framebuffer;
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+		GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST), blend = glIsEnabled(GL_BLEND), cull = glIsEnabled(GL_CULL_FACE), scissor = glIsEnabled(GL_SCISSOR_TEST);
+
+		for (unsigned int type = 0; type < MESH_TEXTURE_TYPE_COUNT; type++)
+		{
+			// the largest texture of the type sets the layer size, unless they all match and can be copied
+			GLint width = 0, height = 0, sourceWidth = 0, sourceHeight = 0, levels = 0;
+			GLenum format = 0;
+			bool copyable = true, any = false;
+			for (unsigned int m = 0; m < materials.size(); m++)
+			{
+				if (materials[m][type] == 0)
+					continue;
+				GLint w, h, internalFormat, compressed;
+				bindOn(0, GL_TEXTURE_2D, materials[m][type]);
+				glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &w);
+				glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &h);
+				glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+				glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &compressed);
+				GLint l = levelCount(w, h);
+				copyable = copyable && compressed && isBlockFormat(internalFormat)
+					&& (!any || ((GLenum)internalFormat == format && w == sourceWidth && h == sourceHeight && l == levels));
+				if (!any)
+				{
+					format = internalFormat;
+					sourceWidth = w;
+					sourceHeight = h;
+					levels = l;
+				}
+				any = true;
+				width = std::max(width, std::min(w, MAX_LAYER_SIZE));
+				height = std::max(height, std::min(h, MAX_LAYER_SIZE));
+			}
+			if (width == 0 || height == 0)
+				continue;
+			if (copyable)
+			{
+				copyCompressed(type, format, sourceWidth, sourceHeight, levels, neutral[type]);
+				continue;
+			}
+
+			if (program == 0)
+			{
+				program = copyProgram();
+				glGenVertexArrays(1, &emptyVAO);
+				glGenFramebuffers(1, &fbo);
+				glDisable(GL_DEPTH_TEST);
+				glDisable(GL_BLEND);
+				glDisable(GL_CULL_FACE);
+				glDisable(GL_SCISSOR_TEST);
+			}
+
+			glGenTextures(1, &arrays[type]);
+			bindOn(type * MESH_TEXTURES_PER_TYPE, GL_TEXTURE_2D_ARRAY, arrays[type]);
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, width, height, (GLsizei)materials.size(), 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+			glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+			glViewport(0, 0, width, height);
+			glState().useProgram(program);
+			glState().bindVertexArray(emptyVAO);
+			for (unsigned int m = 0; m < materials.size(); m++)
+			{
+				glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, arrays[type], 0, m);
+				if (materials[m][type] == 0)
+				{
+					glClearBufferfv(GL_COLOR, 0, neutral[type]);
+					continue;
+				}
+				// the source's own mipmaps filter it down when the layer is smaller
+				bindOn(0, GL_TEXTURE_2D, materials[m][type]);
+				glDrawArrays(GL_TRIANGLES, 0, 3);
+			}
+			bindOn(type * MESH_TEXTURES_PER_TYPE, GL_TEXTURE_2D_ARRAY, arrays[type]);
+			glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+		}
+
+		if (program == 0)
+			return;
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+		if (depthTest) glEnable(GL_DEPTH_TEST);
+		if (blend) glEnable(GL_BLEND);
+		if (cull) glEnable(GL_CULL_FACE);
+		if (scissor) glEnable(GL_SCISSOR_TEST);
+		glDeleteFramebuffers(1, &fbo);
+		glState().deleteVertexArrays(1, &emptyVAO);
+		glState().deleteProgram(program);
+	}
+
+	// the levels the texture bound to GL_TEXTURE_2D on the active unit has, up to its GL_TEXTURE_MAX_LEVEL
+	static GLint levelCount(GLint width, GLint height)
+	{
+		GLint maxLevel, levels = 0;
+		glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, &maxLevel);
+		while (levels <= maxLevel)
+		{
+			GLint w;
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, levels, GL_TEXTURE_WIDTH, &w);
+			if (w != std::max(1, width >> levels))
+				break;
+			levels++;
+			if (width >> levels == 0 && height >> levels == 0)
+				break;
+		}
+		return levels;
+	}
+
+	static bool isBlockFormat(GLint format)
+	{
+		return format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT || format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+			|| format == GL_COMPRESSED_RED_RGTC1 || format == GL_COMPRESSED_RG_RGTC2;
+	}
+
+	// copies the blocks of every level of the type's textures into a compressed array. They go through a
+	// pixel pack buffer, so the data stays on the GPU; neutral layers are encoded here
+	// ------------------------------------------------------------------------
+	void copyCompressed(unsigned int type, GLenum format, GLint width, GLint height, GLint levels, const GLfloat *neutral)
+	{
+		GLsizei layers = (GLsizei)materials.size();
+		glGenTextures(1, &arrays[type]);
+		bindOn(type * MESH_TEXTURES_PER_TYPE, GL_TEXTURE_2D_ARRAY, arrays[type]);
+		for (GLint level = 0; level < levels; level++)
+		{
+			GLint w = std::max(1, width >> level), h = std::max(1, height >> level);
+			glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, format, w, h, layers, 0, (GLsizei)(compressedLevelBytes(format, w, h) * layers), NULL);
+		}
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		GLuint staging;
+		glGenBuffers(1, &staging);
+		glState().bindBuffer(GL_PIXEL_PACK_BUFFER, staging);
+		glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)compressedLevelBytes(format, width, height), NULL, GL_STREAM_COPY);
+		vector<unsigned char> pixels, blocks;
+		for (GLsizei m = 0; m < layers; m++)
+		{
+			for (GLint level = 0; level < levels; level++)
+			{
+				GLint w = std::max(1, width >> level), h = std::max(1, height >> level);
+				GLsizei bytes = (GLsizei)compressedLevelBytes(format, w, h);
+				if (materials[m][type] == 0)
+				{
+					pixels.resize((size_t)w * h * 4);
+					for (size_t i = 0; i < pixels.size(); i++)
+						pixels[i] = (unsigned char)(neutral[i % 4] * 255.0f + 0.5f);
+					blocks.resize(bytes);
+					compressLevel(pixels.data(), w, h, 4, format, blocks.data());
+					bindOn(type * MESH_TEXTURES_PER_TYPE, GL_TEXTURE_2D_ARRAY, arrays[type]);
+					glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, m, w, h, 1, format, bytes, blocks.data());
+					continue;
+				}
+				bindOn(0, GL_TEXTURE_2D, materials[m][type]);
+				glGetCompressedTexImage(GL_TEXTURE_2D, level, (void*)0);
+				glState().bindBuffer(GL_PIXEL_UNPACK_BUFFER, staging);
+				bindOn(type * MESH_TEXTURES_PER_TYPE, GL_TEXTURE_2D_ARRAY, arrays[type]);
+				glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, m, w, h, 1, format, bytes, (void*)0);
+				glState().bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			}
+		}
+		glState().bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		glState().deleteBuffers(1, &staging);
+	}
+
+	// draws the texture on unit 0 over the whole viewport, from a single triangle without attributes
+	static GLuint copyProgram()
+	{
+		const char *vertexSource =
+			"#version 330 core\n"
+			"out vec2 TexCoords;\n"
+			"void main()\n"
+			"{\n"
+			"    vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);\n"
+			"    TexCoords = corner;\n"
+			"    gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);\n"
+			"}\n";
+		const char *fragmentSource =
+			"#version 330 core\n"
+			"in vec2 TexCoords;\n"
+			"out vec4 FragColor;\n"
+			"uniform sampler2D source;\n"
+			"void main()\n"
+			"{\n"
+			"    FragColor = texture(source, TexCoords);\n"
+			"}\n";
+		GLuint vertex = glCreateShader(GL_VERTEX_SHADER);
+		glShaderSource(vertex, 1, &vertexSource, NULL);
+		glCompileShader(vertex);
+		GLuint fragment = glCreateShader(GL_FRAGMENT_SHADER);
+		glShaderSource(fragment, 1, &fragmentSource, NULL);
+		glCompileShader(fragment);
+		GLuint program = glCreateProgram();
+		glAttachShader(program, vertex);
+		glAttachShader(program, fragment);
+		glLinkProgram(program);
+		glDeleteShader(vertex);
+		glDeleteShader(fragment);
+		GLint success;
+		glGetProgramiv(program, GL_LINK_STATUS, &success);
+		if (!success)
+		{
+			GLchar infoLog[1024];
+			glGetProgramInfoLog(program, 1024, NULL, infoLog);
+			cout << "ERROR::MODEL_BATCH::COPY_PROGRAM\n" << infoLog << endl;
+		}
+		// the sampler defaults to unit 0
+		return program;
+	}
+};
+#endif
@@ -2,9 +2,10 @@
 in vec2 TexCoords;
 out vec4 color;
 
-uniform sampler2D particleTexture;
+uniform sampler2DArray particleTexture;
+uniform float particleLayer;
 
 void main()
 {
-    color = texture(particleTexture, TexCoords);
+    color = texture(particleTexture, vec3(TexCoords, particleLayer));
 }
\ No newline at end of file
@@ -5,10 +5,14 @@ layout (location = 2) in mat4 instanceMatrix;
 
 out vec2 TexCoords;
 
-//uniform mat4 projection;
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+//ÿ֡͵ƹ(std140,main.cppеFrameDataһ)
+layout (std140) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+    vec4 viewPos;            // xyz
+    vec4 lightPositions[4];  // xyz
+    vec4 lightColors[4];     // rgb
+};
 
 void main()
 {
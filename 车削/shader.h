@@ -4,18 +4,50 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include "cache_file.h"
+#include "gl_extensions.h"
+#include "gl_state.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <unordered_map>
+#include <vector>
+
+// Linked programs are cached as driver binaries (ARB_get_program_binary) under SHADER_CACHE_DIR, one file
+// per vertex/fragment pair. A binary is only used if it was built from the same sources by the same driver;
+// a binary the driver rejects anyway (after an update it doesn't report, say) is rebuilt from source.
+
+const char SHADER_CACHE_MAGIC[4] = { 'S', 'P', 'R', 'G' };
+const uint32_t SHADER_CACHE_VERSION = 1;
+const char *const SHADER_CACHE_DIR = "cache/shaders";
+
+struct ShaderCacheHeader {
+	char     magic[4];
+	uint32_t version;
+	uint64_t sourceHash;	// both sources
+	uint64_t driverHash;	// vendor, renderer and version strings
+	uint32_t binaryFormat;
+	uint32_t binaryLength;
+};
 
 class Shader
 {
 public:
 	unsigned int ID;
-	// constructor generates the shader on the fly
+	// constructor generates the shader on the fly. With async the compile and link are only submitted:
+	// drivers with KHR_parallel_shader_compile build the program on their own threads while the caller
+	// goes on, isReady() polls, and finish() (which must run before the program is used) waits for it.
+	// Without the extension finish() simply blocks in the driver like a synchronous build.
+	// defines ("#define NAME value" lines) are inserted into both sources right after #version, to build
+	// a variant of the program; see ShaderVariants.
 	// ------------------------------------------------------------------------
-	Shader(const char* vertexPath, const char* fragmentPath)
+	Shader(const char* vertexPath, const char* fragmentPath, bool async = false, const std::string &defines = "") : pending(false)
 	{
 		// 1. retrieve the vertex/fragment source code from filePath
 		std::string vertexCode;
@@ -45,100 +77,395 @@ public:
 		{
 			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
 		}
+		start = std::chrono::steady_clock::now();
+		name = std::string(vertexPath) + " + " + fragmentPath;
+		if (!defines.empty())
+		{
+			vertexCode = injectDefines(vertexCode, defines);
+			fragmentCode = injectDefines(fragmentCode, defines);
+			name += " [" + defineLabel(defines) + "]";
+		}
+		cachePath = cacheFilePath(SHADER_CACHE_DIR, hashBytes(name.data(), name.size()), "prog");
+		sourceHash = hashBytes(fragmentCode.data(), fragmentCode.size(), hashBytes(vertexCode.data(), vertexCode.size()));
+		if (loadProgramBinary(cachePath, sourceHash))
+		{
+			std::cout << "Shader " << name << ": program cache hit, " << millisecondsSince(start) << " ms" << std::endl;
+			cacheUniforms();
+			return;
+		}
+
 		const char* vShaderCode = vertexCode.c_str();
 		const char * fShaderCode = fragmentCode.c_str();
 		// 2. compile shaders
-		unsigned int vertex, fragment;
 		// vertex shader
 		vertex = glCreateShader(GL_VERTEX_SHADER);
 		glShaderSource(vertex, 1, &vShaderCode, NULL);
 		glCompileShader(vertex);
-		checkCompileErrors(vertex, "VERTEX");
 		// fragment Shader
 		fragment = glCreateShader(GL_FRAGMENT_SHADER);
 		glShaderSource(fragment, 1, &fShaderCode, NULL);
 		glCompileShader(fragment);
-		checkCompileErrors(fragment, "FRAGMENT");
+		compileTime = -1.0;
+		if (!async)
+		{
+			checkCompileErrors(vertex, "VERTEX");
+			checkCompileErrors(fragment, "FRAGMENT");
+			compileTime = millisecondsSince(start);
+		}
 		// shader Program
 		ID = glCreateProgram();
 		glAttachShader(ID, vertex);
 		glAttachShader(ID, fragment);
+		if (glExtensions().programBinary)
+			glExtensions().ProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		linkStart = std::chrono::steady_clock::now();
 		glLinkProgram(ID);
-		checkCompileErrors(ID, "PROGRAM");
+		pending = true;
+		if (!async)
+			finish();
+	}
+	// true once the program can be used without waiting for the driver. Never blocks.
+	// ------------------------------------------------------------------------
+	bool isReady() const
+	{
+		if (!pending || !glExtensions().parallelShaderCompile)
+			return true;
+		GLint complete = 0;
+		glGetProgramiv(ID, GL_COMPLETION_STATUS_KHR, &complete);
+		return complete != 0;
+	}
+	// completes an async build: reports errors, stores the program binary and resolves the uniforms
+	// ------------------------------------------------------------------------
+	void finish()
+	{
+		if (!pending)
+			return;
+		pending = false;
+		if (compileTime < 0.0)
+		{
+			checkCompileErrors(vertex, "VERTEX");
+			checkCompileErrors(fragment, "FRAGMENT");
+		}
+		bool linked = checkCompileErrors(ID, "PROGRAM");
+		double linkTime = millisecondsSince(linkStart);
 		// delete the shaders as they're linked into our program now and no longer necessery
 		glDeleteShader(vertex);
 		glDeleteShader(fragment);
-
+		if (compileTime >= 0.0)
+			std::cout << "Shader " << name << ": compiled in " << compileTime << " ms, linked in " << linkTime << " ms" << std::endl;
+		else if (glExtensions().parallelShaderCompile)
+			std::cout << "Shader " << name << ": compiled and linked in the background, ready after " << millisecondsSince(start) << " ms" << std::endl;
+		else
+			std::cout << "Shader " << name << ": compiled and linked when finished (no parallel shader compile), ready after " << millisecondsSince(start) << " ms" << std::endl;
+		if (linked)
+			saveProgramBinary(cachePath, sourceHash);
+		cacheUniforms();
 	}
 	// activate the shader
 	// ------------------------------------------------------------------------
 	void use() const
 	{
-		glUseProgram(ID);
+		glState().useProgram(ID);
 	}
-	// utility uniform functions
+	// location of a uniform, or -1 if the program has no active uniform of that name. Resolved from the
+	// table built at link time, so look handles up once during setup and pass them to the setters below.
+	// Array elements are found as "name[i]"; "name" is the first element.
 	// ------------------------------------------------------------------------
+	GLint uniform(const std::string &name) const
+	{
+		std::unordered_map<std::string, GLint>::const_iterator it = locations.find(name);
+		return it != locations.end() ? it->second : -1;
+	}
+	// attaches the uniform block blockName to a binding point, where a UniformBuffer provides it. Once per
+	// program; programs that don't use the block (or optimised it away) are left alone.
+	// ------------------------------------------------------------------------
+	void bindUniformBlock(const char *blockName, GLuint binding) const
+	{
+		GLuint index = glGetUniformBlockIndex(ID, blockName);
+		if (index != GL_INVALID_INDEX)
+			glUniformBlockBinding(ID, index, binding);
+	}
+	// names of the active uniforms with their locations
+	const std::unordered_map<std::string, GLint>& uniforms() const
+	{
+		return locations;
+	}
+	// utility uniform functions. The handle overloads make no GL queries and allocate nothing; the name
+	// overloads look the handle up in the table and are meant for setup code.
+	// ------------------------------------------------------------------------
+	void setBool(GLint location, bool value) const
+	{
+		glUniform1i(location, (int)value);
+	}
 	void setBool(const std::string &name, bool value) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+		setBool(uniform(name), value);
 	}
 	// ------------------------------------------------------------------------
+	void setInt(GLint location, int value) const
+	{
+		glUniform1i(location, value);
+	}
 	void setInt(const std::string &name, int value) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+		setInt(uniform(name), value);
 	}
 	// ------------------------------------------------------------------------
+	void setFloat(GLint location, float value) const
+	{
+		glUniform1f(location, value);
+	}
 	void setFloat(const std::string &name, float value) const
 	{
-		glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+		setFloat(uniform(name), value);
 	}
 	// ------------------------------------------------------------------------
+	void setVec2(GLint location, const glm::vec2 &value) const
+	{
+		glUniform2fv(location, 1, &value[0]);
+	}
+	void setVec2(GLint location, float x, float y) const
+	{
+		glUniform2f(location, x, y);
+	}
 	void setVec2(const std::string &name, const glm::vec2 &value) const
 	{
-		glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		setVec2(uniform(name), value);
 	}
 	void setVec2(const std::string &name, float x, float y) const
 	{
-		glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+		setVec2(uniform(name), x, y);
 	}
 	// ------------------------------------------------------------------------
+	void setVec3(GLint location, const glm::vec3 &value) const
+	{
+		glUniform3fv(location, 1, &value[0]);
+	}
+	void setVec3(GLint location, float x, float y, float z) const
+	{
+		glUniform3f(location, x, y, z);
+	}
+	// sets count consecutive elements of a vec3 array, starting at the element location refers to
+	void setVec3Array(GLint location, const glm::vec3 *values, int count) const
+	{
+		glUniform3fv(location, count, &values[0][0]);
+	}
 	void setVec3(const std::string &name, const glm::vec3 &value) const
 	{
-		glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		setVec3(uniform(name), value);
 	}
 	void setVec3(const std::string &name, float x, float y, float z) const
 	{
-		glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+		setVec3(uniform(name), x, y, z);
 	}
 	// ------------------------------------------------------------------------
+	void setVec4(GLint location, const glm::vec4 &value) const
+	{
+		glUniform4fv(location, 1, &value[0]);
+	}
+	void setVec4(GLint location, float x, float y, float z, float w) const
+	{
+		glUniform4f(location, x, y, z, w);
+	}
 	void setVec4(const std::string &name, const glm::vec4 &value) const
 	{
-		glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		setVec4(uniform(name), value);
 	}
 	void setVec4(const std::string &name, float x, float y, float z, float w) const
 	{
-		glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+		setVec4(uniform(name), x, y, z, w);
 	}
 	// ------------------------------------------------------------------------
+	void setMat2(GLint location, const glm::mat2 &mat) const
+	{
+		glUniformMatrix2fv(location, 1, GL_FALSE, &mat[0][0]);
+	}
 	void setMat2(const std::string &name, const glm::mat2 &mat) const
 	{
-		glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		setMat2(uniform(name), mat);
 	}
 	// ------------------------------------------------------------------------
+	void setMat3(GLint location, const glm::mat3 &mat) const
+	{
+		glUniformMatrix3fv(location, 1, GL_FALSE, &mat[0][0]);
+	}
 	void setMat3(const std::string &name, const glm::mat3 &mat) const
 	{
-		glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		setMat3(uniform(name), mat);
 	}
 	// ------------------------------------------------------------------------
+	void setMat4(GLint location, const glm::mat4 &mat) const
+	{
+		glUniformMatrix4fv(location, 1, GL_FALSE, &mat[0][0]);
+	}
 	void setMat4(const std::string &name, const glm::mat4 &mat) const
 	{
-		glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		setMat4(uniform(name), mat);
 	}
 
 private:
+	std::unordered_map<std::string, GLint> locations;
+	// the build in flight between the constructor and finish()
+	bool pending;
+	unsigned int vertex, fragment;
+	std::string name, cachePath;
+	uint64_t sourceHash;
+	std::chrono::steady_clock::time_point start;
+	std::chrono::steady_clock::time_point linkStart;	// just before glLinkProgram
+	double compileTime;	// -1 if the compile wasn't waited for
+
+	// source with defines placed after its #version line; #line keeps the compiler's line numbers right
+	static std::string injectDefines(const std::string &code, const std::string &defines)
+	{
+		size_t version = code.find("#version");
+		size_t lineEnd = version == std::string::npos ? std::string::npos : code.find('\n', version);
+		if (lineEnd == std::string::npos)
+			return defines + "#line 1\n" + code;
+		int nextLine = 2;
+		for (size_t i = 0; i < version; i++)
+			if (code[i] == '\n')
+				nextLine++;
+		return code.substr(0, lineEnd + 1) + defines + "#line " + std::to_string(nextLine) + "\n" + code.substr(lineEnd + 1);
+	}
+
+	// "#define A 1\n#define B 0\n" -> "A=1 B=0", to tell variants apart in the log and the cache key
+	static std::string defineLabel(const std::string &defines)
+	{
+		std::istringstream lines(defines);
+		std::string label, directive, macro, value;
+		while (lines >> directive >> macro)
+		{
+			std::getline(lines, value);
+			size_t first = value.find_first_not_of(' ');
+			label += (label.empty() ? "" : " ") + macro + (first == std::string::npos ? "" : "=" + value.substr(first));
+		}
+		return label;
+	}
+
+	static double millisecondsSince(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// identifies the driver a program binary was made by
+	static uint64_t driverHash()
+	{
+		uint64_t hash = hashBytes(NULL, 0);
+		const GLenum strings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+		for (unsigned int i = 0; i < sizeof(strings) / sizeof(strings[0]); i++)
+		{
+			const char *value = (const char*)glGetString(strings[i]);
+			if (value)
+				hash = hashBytes(value, strlen(value) + 1, hash);
+		}
+		return hash;
+	}
+
+	// creates ID from the cached binary if it matches the sources and the driver accepts it
+	// ------------------------------------------------------------------------
+	bool loadProgramBinary(const std::string &cachePath, uint64_t sourceHash)
+	{
+		if (!glExtensions().programBinary)
+			return false;
+		std::ifstream file(cachePath, std::ios::binary);
+		ShaderCacheHeader header;
+		if (!file.read((char*)&header, sizeof(header)) || memcmp(header.magic, SHADER_CACHE_MAGIC, 4) != 0
+			|| header.version != SHADER_CACHE_VERSION || header.sourceHash != sourceHash || header.driverHash != driverHash())
+			return false;
+		std::vector<char> binary(header.binaryLength);
+		if (binary.empty() || !file.read(binary.data(), binary.size()))
+			return false;
+		ID = glCreateProgram();
+		glExtensions().ProgramBinary(ID, header.binaryFormat, binary.data(), (GLsizei)binary.size());
+		GLint success = 0;
+		glGetProgramiv(ID, GL_LINK_STATUS, &success);
+		if (!success)
+		{
+			std::cout << "Program binary " << cachePath << " rejected by the driver, compiling from source" << std::endl;
+			glState().deleteProgram(ID);
+			ID = 0;
+			return false;
+		}
+		return true;
+	}
+
+	// writes ID's binary for later runs
+	// ------------------------------------------------------------------------
+	void saveProgramBinary(const std::string &cachePath, uint64_t sourceHash) const
+	{
+		if (!glExtensions().programBinary)
+			return;
+		GLint length = 0;
+		glGetProgramiv(ID, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0)
+			return;
+		std::vector<char> binary(length);
+		ShaderCacheHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, SHADER_CACHE_MAGIC, 4);
+		header.version = SHADER_CACHE_VERSION;
+		header.sourceHash = sourceHash;
+		header.driverHash = driverHash();
+		GLenum format = 0;
+		GLsizei written = 0;
+		glExtensions().GetProgramBinary(ID, length, &written, &format, binary.data());
+		if (written <= 0)
+			return;
+		header.binaryFormat = format;
+		header.binaryLength = (uint32_t)written;
+
+		// temporary name first, like the other caches
+		createCacheDir(SHADER_CACHE_DIR);
+		std::string tempPath = cachePath + ".tmp";
+		FILE *out = fopen(tempPath.c_str(), "wb");
+		if (!out)
+			return;
+		bool ok = fwrite(&header, sizeof(header), 1, out) == 1 && fwrite(binary.data(), 1, written, out) == (size_t)written;
+		fclose(out);
+		remove(cachePath.c_str());
+		if (!ok || rename(tempPath.c_str(), cachePath.c_str()) != 0)
+			remove(tempPath.c_str());
+	}
+
+	// fills the location table from the program's active uniforms, once after linking
+	// ------------------------------------------------------------------------
+	void cacheUniforms()
+	{
+		locations.clear();
+		GLint count = 0, maxLength = 0;
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+		std::vector<GLchar> buffer(maxLength > 0 ? maxLength : 1);
+		for (GLint i = 0; i < count; i++)
+		{
+			GLsizei length = 0;
+			GLint size = 0;
+			GLenum type;
+			glGetActiveUniform(ID, (GLuint)i, (GLsizei)buffer.size(), &length, &size, &type, buffer.data());
+			std::string name(buffer.data(), length);
+			GLint location = glGetUniformLocation(ID, name.c_str());
+			if (location < 0)
+				continue;  // a member of a uniform block
+			locations[name] = location;
+			// arrays are reported once, as "name[0]"
+			size_t bracket = name.rfind("[0]");
+			if (bracket == std::string::npos || bracket + 3 != name.size())
+				continue;
+			std::string base = name.substr(0, bracket);
+			locations[base] = location;
+			for (GLint element = 1; element < size; element++)
+			{
+				std::string elementName = base + "[" + std::to_string(element) + "]";
+				GLint elementLocation = glGetUniformLocation(ID, elementName.c_str());
+				if (elementLocation >= 0)
+					locations[elementName] = elementLocation;
+			}
+		}
+	}
+
 	// utility function for checking shader compilation/linking errors.
 	// ------------------------------------------------------------------------
-	void checkCompileErrors(GLuint shader, std::string type)
+	bool checkCompileErrors(GLuint shader, std::string type)
 	{
 		GLint success;
 		GLchar infoLog[1024];
@@ -160,6 +487,7 @@ private:
 				std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
 			}
 		}
+		return success != 0;
 	}
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,107 @@
+#ifndef SHADER_VARIANTS_H
+#define SHADER_VARIANTS_H
+
+#include "shader.h"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// The features a lit material program is specialised for. Each combination becomes #defines, so the
+// shader's light loop and material branches are resolved at compile time instead of per pixel.
+struct ShaderFeatures {
+	unsigned int lightCount;	// LIGHT_COUNT: lights the loop runs over, 1..MAX_LIGHT_COUNT
+	bool normalMap;			// NORMAL_MAP: perturb the normal with the normal map, else use the vertex normal
+	bool cutBlending;		// CUT_BLENDING: pick the cut material where the stock has been cut
+
+	static const unsigned int MAX_LIGHT_COUNT = 4;
+
+	ShaderFeatures(unsigned int lightCount = MAX_LIGHT_COUNT, bool normalMap = true, bool cutBlending = true)
+		: lightCount(lightCount), normalMap(normalMap), cutBlending(cutBlending) {}
+
+	uint32_t key() const
+	{
+		return (uint32_t)lightCount | (normalMap ? 1u << 8 : 0u) | (cutBlending ? 1u << 9 : 0u);
+	}
+
+	std::string defines() const
+	{
+		return "#define LIGHT_COUNT " + std::to_string(lightCount) + "\n"
+			+ "#define NORMAL_MAP " + (normalMap ? "1" : "0") + "\n"
+			+ "#define CUT_BLENDING " + (cutBlending ? "1" : "0") + "\n";
+	}
+};
+
+// The programs built from one vertex/fragment pair for the feature sets in use, cached by feature key.
+// Each variant is a separate program, so it has its own uniform locations: the names given to the
+// constructor are resolved once per variant into Variant::uniforms (same order), and setup runs once for
+// every new variant to bind its samplers and uniform blocks. Lookups are a hash of an integer key, so
+// picking the variant every frame costs no string work.
+class ShaderVariants
+{
+public:
+	struct Variant {
+		Shader shader;
+		std::vector<GLint> uniforms;
+		bool ready;
+
+		Variant(const char *vertexPath, const char *fragmentPath, bool async, const std::string &defines)
+			: shader(vertexPath, fragmentPath, async, defines), ready(false) {}
+	};
+
+	ShaderVariants(const char *vertexPath, const char *fragmentPath, const std::vector<std::string> &uniformNames,
+		std::function<void(Shader&)> setup)
+		: vertexPath(vertexPath), fragmentPath(fragmentPath), uniformNames(uniformNames), setup(setup) {}
+
+	// starts building the variant for features in the background if it doesn't exist yet (see Shader's
+	// async constructor). The returned program may still be compiling; get() completes it.
+	// ------------------------------------------------------------------------
+	Shader& request(const ShaderFeatures &features)
+	{
+		return find(features, true).shader;
+	}
+
+	// the variant for features, built now if it wasn't requested before. Must run on the GL thread.
+	// ------------------------------------------------------------------------
+	Variant& get(const ShaderFeatures &features)
+	{
+		Variant &variant = find(features, false);
+		if (!variant.ready)
+		{
+			variant.shader.finish();
+			variant.uniforms.resize(uniformNames.size());
+			for (unsigned int i = 0; i < uniformNames.size(); i++)
+				variant.uniforms[i] = variant.shader.uniform(uniformNames[i]);
+			variant.shader.use();
+			setup(variant.shader);
+			variant.ready = true;
+		}
+		return variant;
+	}
+
+	unsigned int size() const
+	{
+		return (unsigned int)variants.size();
+	}
+
+private:
+	std::string vertexPath, fragmentPath;
+	std::vector<std::string> uniformNames;
+	std::function<void(Shader&)> setup;
+	std::unordered_map<uint32_t, std::unique_ptr<Variant>> variants;
+
+	Variant& find(const ShaderFeatures &features, bool async)
+	{
+		std::unordered_map<uint32_t, std::unique_ptr<Variant>>::iterator it = variants.find(features.key());
+		if (it == variants.end())
+		{
+			std::unique_ptr<Variant> variant(new Variant(vertexPath.c_str(), fragmentPath.c_str(), async, features.defines()));
+			it = variants.insert(std::make_pair(features.key(), std::move(variant))).first;
+		}
+		return *it->second;
+	}
+};
+#endif
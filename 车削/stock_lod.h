@@ -0,0 +1,421 @@
+#ifndef STOCK_LOD_H
+#define STOCK_LOD_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "gl_state.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+using namespace std;
+
+// Chunks and levels of detail of the turned stock, a surface of revolution over slices x stacks whose
+// radius profile changes as it is cut.
+//
+// The stock is split along its axis into chunks of CHUNK_STACKS stacks. Each chunk has its own vertex range
+// (a slice-major grid of its slices + 1 by stacks + 1 vertices, so the stack on a chunk boundary is stored
+// by both chunks), its own region of the shared index buffer and its own dirty flag: a cut rewrites and
+// re-indexes only the chunks it reaches. The two end caps follow the chunks in the vertex buffer (see
+// capVertex).
+//
+// A level keeps every sliceStride-th slice and only the stacks the profile needs to stay within its
+// tolerance: stacks that lie (within tolerance) on the line between their kept neighbours and have the same
+// cut flag are merged. Level 0 keeps every slice and merges exact lines only, so it matches the full grid
+// with a fraction of its triangles. Each chunk picks its level from its own screen scale and radius;
+// neighbouring chunks have to share their boundary ring, so the slice stride drawn is the finest any drawn
+// chunk picked, while the stack tolerance is each chunk's own.
+//
+// A chunk is drawn as one triangle strip per slice interval with primitive restart between them, in
+// 16-bit indices relative to the chunk's first vertex. Chunks outside the view volume are skipped, and of
+// the others only the strips facing the camera (see View) are drawn, all in one
+// glMultiDrawElementsBaseVertex. GL thread only.
+class StockLod
+{
+public:
+	struct Level {
+		unsigned int sliceStride;	// keeps every sliceStride-th slice
+		int tolerance;			// largest radius deviation of a merged stack, in radius steps
+	};
+
+	// The part of the stock facing the camera: the slices within arcHalfWidth of arcCenter (radians around
+	// the stock's axis, from +x towards +y) and the end caps.
+	struct View {
+		double arcCenter, arcHalfWidth;
+		bool caps[2];	// the cap at z = 0 and at z = length
+
+		View() : arcCenter(0.0), arcHalfWidth(PI)
+		{
+			caps[0] = caps[1] = true;
+		}
+	};
+
+	static const unsigned int MAX_LEVEL_COUNT = 5;
+	static const int CHUNK_STACKS = 64;
+	static const GLushort RESTART_INDEX = 0xFFFF;
+	static constexpr double PI = 3.14159265358979;
+
+	// radiusStep is the length of one radius step, maxRadius the uncut radius (cuts only make it smaller)
+	// and length the stock's length along z
+	StockLod(unsigned int slices, unsigned int stacks, double radiusStep, double maxRadius, double length)
+		: slices(slices), stacks(stacks), radiusStep(radiusStep), maxRadius(maxRadius), length(length), levelCount(0),
+		drawnTriangles(0), drawnChunks(0), drawnStride(0)
+	{
+		static const Level table[MAX_LEVEL_COUNT] = { { 1, 0 }, { 2, 1 }, { 4, 2 }, { 6, 4 }, { 12, 8 } };
+		for (unsigned int i = 0; i < MAX_LEVEL_COUNT; i++)
+		{
+			// a level has to reach the last slice, which closes the stock at 360 degrees
+			if (slices % table[i].sliceStride == 0)
+				levels[levelCount++] = table[i];
+		}
+
+		// every chunk gets room for its strips at the finest level, the caps of every level follow
+		unsigned int chunkCount = (stacks + CHUNK_STACKS - 1) / CHUNK_STACKS;
+		size_t capacity = 0;
+		for (unsigned int c = 0; c < chunkCount; c++)
+		{
+			Chunk chunk;
+			chunk.first = c * CHUNK_STACKS;
+			chunk.last = std::min(chunk.first + CHUNK_STACKS, (int)stacks);
+			chunk.firstVertex = c * (slices + 1) * (CHUNK_STACKS + 1);
+			chunk.offset = capacity;
+			chunk.radius = 0;
+			chunk.dirty = true;
+			chunk.builtLevel = chunk.builtStride = 0;
+			for (unsigned int l = 0; l < MAX_LEVEL_COUNT; l++)
+				chunk.keptDirty[l] = true;
+			chunks.push_back(chunk);
+			capacity += slices * (2 * (chunk.last - chunk.first + 1) + 1);
+		}
+		vector<GLushort> caps;
+		for (unsigned int l = 0; l < levelCount; l++)
+		{
+			// fans around the centre at the level's slices, wound like the sides seen from outside: the cap
+			// at z = 0 with rising angle, the one at z = length against it
+			for (unsigned int end = 0; end < 2; end++)
+			{
+				capOffsets[l][end] = capacity + caps.size();
+				caps.push_back(0);
+				for (unsigned int i = 0; i <= slices; i += levels[l].sliceStride)
+					caps.push_back((GLushort)(1 + (end == 0 ? i : slices - i)));
+			}
+		}
+		capacity += caps.size();
+
+		// the element buffer binding belongs to a vertex array, so it is filled through the copy target
+		glGenBuffers(1, &ebo);
+		glState().bindBuffer(GL_COPY_WRITE_BUFFER, ebo);
+		glBufferData(GL_COPY_WRITE_BUFFER, capacity * sizeof(GLushort), NULL, GL_DYNAMIC_DRAW);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, capOffsets[0][0] * sizeof(GLushort), caps.size() * sizeof(GLushort), &caps[0]);
+		glPrimitiveRestartIndex(RESTART_INDEX);
+	}
+
+	~StockLod()
+	{
+		glState().deleteBuffers(1, &ebo);
+	}
+
+	StockLod(const StockLod&) = delete;
+	StockLod& operator=(const StockLod&) = delete;
+
+	// vertex layout
+	// ------------------------------------------------------------------------
+	unsigned int chunkCount() const { return (unsigned int)chunks.size(); }
+	int chunkFirstStack(unsigned int chunk) const { return chunks[chunk].first; }
+	int chunkLastStack(unsigned int chunk) const { return chunks[chunk].last; }
+
+	// the vertex of slice and stack in chunk; stack is counted from the stock's start and must lie in the chunk
+	unsigned int vertex(unsigned int chunk, unsigned int slice, int stack) const
+	{
+		return chunks[chunk].firstVertex + slice * (CHUNK_STACKS + 1) + (stack - chunks[chunk].first);
+	}
+
+	// The caps follow the chunks: for each end (0 at z = 0, 1 at z = length) a centre vertex and then
+	// slices + 1 rim vertices, rim vertex i at slice i's angle. rim < 0 is the centre.
+	unsigned int capVertex(unsigned int end, int rim) const
+	{
+		return (unsigned int)chunks.size() * (slices + 1) * (CHUNK_STACKS + 1) + end * (slices + 2) + 1 + rim;
+	}
+
+	unsigned int vertexCount() const
+	{
+		return capVertex(2, -1);
+	}
+
+	// the radius or cut flag of stacks first..last changed
+	// ------------------------------------------------------------------------
+	void invalidate(int first, int last)
+	{
+		for (unsigned int c = 0; c < chunks.size(); c++)
+		{
+			if (chunks[c].last < first || chunks[c].first > last)
+				continue;
+			chunks[c].dirty = true;
+			for (unsigned int l = 0; l < MAX_LEVEL_COUNT; l++)
+				chunks[c].keptDirty[l] = true;
+		}
+	}
+
+	// the largest distance between a level's surface and the full grid, in object units, where the stock's
+	// radius is at most radius
+	double error(unsigned int level, double radius) const
+	{
+		const Level &l = levels[level];
+		double sag = radius * (1.0 - cos(PI * l.sliceStride / slices));
+		return std::max(sag, l.tolerance * radiusStep);
+	}
+
+	// The part facing a parallel projection looking against toEye, given in the stock's model space. A
+	// slice faces the camera within 90 degrees of toEye's direction around the axis; margin widens that
+	// for the facets. Where the cut profile slopes, a face leans along the axis and is seen from further
+	// round once the camera isn't square to the axis, so then every slice is drawn.
+	// ------------------------------------------------------------------------
+	static View facing(const glm::vec3 &toEye, double margin)
+	{
+		View view;
+		glm::vec3 eye = glm::normalize(toEye);
+		const double square = 1e-3;
+		if (glm::abs(eye.z) < square)
+		{
+			view.arcCenter = atan2(eye.y, eye.x);
+			view.arcHalfWidth = PI / 2.0 + margin;
+		}
+		view.caps[0] = eye.z < -square;
+		view.caps[1] = eye.z > square;
+		return view;
+	}
+
+	// Draws the stock with vao, whose element buffer binding it replaces. radii (in radius steps) and cut
+	// are the current profile, one entry per stack. modelViewProjection places the stock in clip space and
+	// viewport is the size of the target in pixels; each chunk gets the coarsest level that stays within
+	// maxPixelError there.
+	// ------------------------------------------------------------------------
+	void draw(GLuint vao, const vector<int> &radii, const vector<unsigned char> &cut, const View &view,
+		const glm::mat4 &modelViewProjection, const glm::vec2 &viewport, double maxPixelError)
+	{
+		glState().bindVertexArray(vao);
+		glState().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+
+		// visibility and level of every chunk; the stride is shared
+		unsigned int stride = 0;
+		for (unsigned int c = 0; c < chunks.size(); c++)
+		{
+			Chunk &chunk = chunks[c];
+			if (chunk.dirty)
+				chunk.radius = *std::max_element(radii.begin() + chunk.first, radii.begin() + chunk.last + 1);
+			chunk.visible = inView(chunk, modelViewProjection);
+			if (!chunk.visible)
+				continue;
+			double pixelsPerUnit = pixelScale(chunk, modelViewProjection, viewport);
+			chunk.level = 0;
+			for (unsigned int l = 1; l < levelCount; l++)
+				if (error(l, chunk.radius * radiusStep) * pixelsPerUnit <= maxPixelError)
+					chunk.level = l;
+			unsigned int levelStride = levels[chunk.level].sliceStride;
+			stride = stride == 0 ? levelStride : std::min(stride, levelStride);
+		}
+
+		// runs of visible strips within a chunk are contiguous in the index buffer
+		double sliceAngle = 2.0 * PI / slices;
+		counts.clear();
+		offsets.clear();
+		baseVertices.clear();
+		drawnTriangles = drawnChunks = 0;
+		drawnStride = stride;
+		for (unsigned int c = 0; c < chunks.size(); c++)
+		{
+			Chunk &chunk = chunks[c];
+			if (!chunk.visible)
+				continue;
+			if (chunk.dirty || chunk.builtLevel != chunk.level || chunk.builtStride != stride)
+				rebuild(chunk, stride, radii, cut);
+			drawnChunks++;
+			bool running = false;
+			for (unsigned int strip = 0; strip < slices / stride; strip++)
+			{
+				double middle = (strip + 0.5) * stride * sliceAngle;
+				double distance = fabs(remainder(middle - view.arcCenter, 2.0 * PI));
+				if (distance > view.arcHalfWidth + 0.5 * stride * sliceAngle)
+				{
+					running = false;
+					continue;
+				}
+				if (running)
+					counts.back() += chunk.stripLength;
+				else
+				{
+					counts.push_back(chunk.stripLength);
+					offsets.push_back((const void*)((chunk.offset + strip * chunk.stripLength) * sizeof(GLushort)));
+					baseVertices.push_back((GLint)chunk.firstVertex);
+					running = true;
+				}
+				drawnTriangles += chunk.stripTriangles;
+			}
+		}
+
+		// only the stock's indices are 16-bit, other draws may use 0xFFFF as an index
+		glEnable(GL_PRIMITIVE_RESTART);
+		if (!counts.empty())
+			glMultiDrawElementsBaseVertex(GL_TRIANGLE_STRIP, &counts[0], GL_UNSIGNED_SHORT, &offsets[0],
+				(GLsizei)counts.size(), &baseVertices[0]);
+		glDisable(GL_PRIMITIVE_RESTART);
+
+		unsigned int capLevel = 0;
+		while (capLevel + 1 < levelCount && levels[capLevel].sliceStride != stride)
+			capLevel++;
+		GLsizei capCount = (GLsizei)(slices / levels[capLevel].sliceStride + 2);
+		for (unsigned int end = 0; end < 2; end++)
+		{
+			if (!view.caps[end] || !chunks[end == 0 ? 0 : chunks.size() - 1].visible)
+				continue;
+			glDrawElementsBaseVertex(GL_TRIANGLE_FAN, capCount, GL_UNSIGNED_SHORT,
+				(const void*)(capOffsets[capLevel][end] * sizeof(GLushort)), capVertex(end, -1));
+			drawnTriangles += capCount - 2;
+		}
+	}
+
+	unsigned int size() const { return levelCount; }
+
+	// statistics of the last draw
+	unsigned int triangleCount() const { return drawnTriangles; }
+	unsigned int chunksDrawn() const { return drawnChunks; }
+	unsigned int sliceStride() const { return drawnStride; }
+
+private:
+	struct Chunk {
+		int first, last;	// stacks, both included
+		unsigned int firstVertex;
+		size_t offset;		// of its index region, in indices
+		int radius;		// largest radius, in radius steps
+		bool dirty;		// the profile changed since its indices were built
+		vector<int> kept[MAX_LEVEL_COUNT];	// the stacks each level keeps, both ends included
+		bool keptDirty[MAX_LEVEL_COUNT];
+		// this frame
+		bool visible;
+		unsigned int level;
+		// what its index region holds
+		unsigned int builtLevel, builtStride;
+		GLsizei stripLength;	// indices per strip, its restart included
+		unsigned int stripTriangles;
+	};
+
+	unsigned int slices, stacks;
+	double radiusStep, maxRadius, length;
+	Level levels[MAX_LEVEL_COUNT];
+	unsigned int levelCount;
+	vector<Chunk> chunks;
+	GLuint ebo;
+	size_t capOffsets[MAX_LEVEL_COUNT][2];
+
+	// the multi-draw of the current frame, kept to reuse the allocations
+	vector<GLsizei> counts;
+	vector<const void*> offsets;
+	vector<GLint> baseVertices;
+	unsigned int drawnTriangles, drawnChunks, drawnStride;
+
+	// false if the chunk's bounding box is entirely outside one plane of the view volume
+	bool inView(const Chunk &chunk, const glm::mat4 &modelViewProjection) const
+	{
+		float r = (float)(chunk.radius * radiusStep);
+		float z0 = (float)(length * chunk.first / stacks), z1 = (float)(length * chunk.last / stacks);
+		glm::vec4 corners[8];
+		for (int i = 0; i < 8; i++)
+			corners[i] = modelViewProjection * glm::vec4(i & 1 ? r : -r, i & 2 ? r : -r, i & 4 ? z1 : z0, 1.0f);
+		for (int axis = 0; axis < 3; axis++)
+		{
+			bool below = true, above = true;
+			for (int i = 0; i < 8; i++)
+			{
+				below = below && corners[i][axis] < -corners[i].w;
+				above = above && corners[i][axis] > corners[i].w;
+			}
+			if (below || above)
+				return false;
+		}
+		return true;
+	}
+
+	// pixels one object unit covers at the chunk's centre, along whichever axis it covers most
+	double pixelScale(const Chunk &chunk, const glm::mat4 &modelViewProjection, const glm::vec2 &viewport) const
+	{
+		glm::vec4 centre = modelViewProjection * glm::vec4(0.0f, 0.0f, (float)(length * (chunk.first + chunk.last) / 2.0 / stacks), 1.0f);
+		double scale = 0.0;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			glm::vec2 step = glm::vec2(modelViewProjection[axis]) * viewport * 0.5f;
+			scale = std::max(scale, (double)glm::length(step));
+		}
+		return scale / std::max((double)glm::abs(centre.w), 1e-6);
+	}
+
+	// true if stacks a..b can be drawn as one quad strip: all have a's cut flag and the ones in between
+	// are within tolerance of the line from a to b
+	static bool mergeable(int a, int b, int tolerance, const vector<int> &radii, const vector<unsigned char> &cut)
+	{
+		int span = b - a;
+		for (int j = a + 1; j <= b; j++)
+		{
+			if (cut[j] != cut[a])
+				return false;
+			// compared in whole radius steps scaled by span, so a tolerance of 0 merges exact lines only
+			if (j < b && abs(radii[j] * span - (radii[a] * (b - j) + radii[b] * (j - a))) > tolerance * span)
+				return false;
+		}
+		return true;
+	}
+
+	// the stacks kept between first and last: greedily, each strip segment is extended as far as the
+	// tolerance allows
+	static void simplify(int tolerance, int first, int last, const vector<int> &radii, const vector<unsigned char> &cut,
+		vector<int> &kept)
+	{
+		kept.assign(1, first);
+		for (int a = first; a < last; )
+		{
+			int b = a + 1;
+			while (b < last && mergeable(a, b + 1, tolerance, radii, cut))
+				b++;
+			kept.push_back(b);
+			a = b;
+		}
+	}
+
+	// writes the chunk's strips at its level's tolerance and the given slice stride into its index region
+	// ------------------------------------------------------------------------
+	void rebuild(Chunk &chunk, unsigned int stride, const vector<int> &radii, const vector<unsigned char> &cut)
+	{
+		vector<int> &kept = chunk.kept[chunk.level];
+		if (chunk.keptDirty[chunk.level])
+		{
+			simplify(levels[chunk.level].tolerance, chunk.first, chunk.last, radii, cut, kept);
+			chunk.keptDirty[chunk.level] = false;
+		}
+
+		// the strip of slice interval i..i+stride walks the kept stacks, right slice first so the triangles
+		// wind like the full grid's. Every strip ends with a restart, so all have the same length and a run
+		// of them can be drawn from anywhere in the chunk.
+		unsigned int row = CHUNK_STACKS + 1;
+		vector<GLushort> indices;
+		indices.reserve(slices / stride * (2 * kept.size() + 1));
+		for (unsigned int i = 0; i < slices; i += stride)
+		{
+			unsigned int left = i * row, right = left + stride * row;
+			for (unsigned int k = 0; k < kept.size(); k++)
+			{
+				indices.push_back((GLushort)(right + kept[k] - chunk.first));
+				indices.push_back((GLushort)(left + kept[k] - chunk.first));
+			}
+			indices.push_back((GLushort)RESTART_INDEX);
+		}
+		chunk.stripLength = (GLsizei)(2 * kept.size() + 1);
+		chunk.stripTriangles = 2 * ((unsigned int)kept.size() - 1);
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, chunk.offset * sizeof(GLushort), indices.size() * sizeof(GLushort), &indices[0]);
+
+		chunk.dirty = false;
+		chunk.builtLevel = chunk.level;
+		chunk.builtStride = stride;
+	}
+};
+#endif
@@ -0,0 +1,87 @@
+#ifndef STOCK_VERTEX_H
+#define STOCK_VERTEX_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/type_precision.hpp>
+
+#include "gl_state.h"
+
+#include <cstddef>
+
+// Packed vertex format of the turned stock, 16 bytes instead of 9 floats, in two streams so a cut only
+// rewrites what it changes:
+//   position stream (dynamic), 8 bytes: xyz as 16-bit unorm relative to the stock's bounding box and the
+//     cut flag in w (0 or 1, unorm so it decodes to exactly 0.0 or 1.0)
+//   surface stream (static), 8 bytes: the normal octahedral-encoded in 2 x 16-bit snorm and the texture
+//     coordinates in 2 x 16-bit unorm
+// The shader reads the position in box space; stockPositionDecode() maps it back and is folded into the
+// model matrix, so decoding costs nothing per vertex.
+
+typedef glm::u16vec4 StockPosition;
+
+struct StockSurface {
+	glm::i16vec2 normal;
+	glm::u16vec2 texCoords;
+};
+
+static_assert(sizeof(StockPosition) == 8 && sizeof(StockSurface) == 8, "stock vertex streams must stay packed");
+
+// the stock's bounding box: x and y in [-radius, radius], z in [0, length]
+// ------------------------------------------------------------------------
+inline StockPosition packStockPosition(const glm::vec3 &position, bool cut, float radius, float length)
+{
+	return StockPosition(glm::packUnorm1x16(position.x / (2.0f * radius) + 0.5f),
+		glm::packUnorm1x16(position.y / (2.0f * radius) + 0.5f),
+		glm::packUnorm1x16(position.z / length),
+		cut ? 65535 : 0);
+}
+
+// box space [0, 1]^3 to model space
+inline glm::mat4 stockPositionDecode(float radius, float length)
+{
+	glm::mat4 decode = glm::translate(glm::mat4(1.0f), glm::vec3(-radius, -radius, 0.0f));
+	return glm::scale(decode, glm::vec3(2.0f * radius, 2.0f * radius, length));
+}
+
+// octahedral encoding: n is projected onto the octahedron |x| + |y| + |z| = 1 and the lower half folded
+// over the upper one, so two components keep the whole sphere
+// ------------------------------------------------------------------------
+inline glm::vec2 octEncode(const glm::vec3 &n)
+{
+	glm::vec3 octahedron = n / (glm::abs(n.x) + glm::abs(n.y) + glm::abs(n.z));
+	glm::vec2 encoded(octahedron.x, octahedron.y);
+	if (octahedron.z < 0.0f)
+	{
+		glm::vec2 sign(encoded.x >= 0.0f ? 1.0f : -1.0f, encoded.y >= 0.0f ? 1.0f : -1.0f);
+		encoded = (1.0f - glm::abs(glm::vec2(encoded.y, encoded.x))) * sign;
+	}
+	return encoded;
+}
+
+inline StockSurface packStockSurface(const glm::vec3 &normal, const glm::vec2 &texCoords)
+{
+	glm::vec2 encoded = octEncode(glm::normalize(normal));
+	StockSurface surface;
+	surface.normal = glm::i16vec2((glm::int16)glm::packSnorm1x16(encoded.x), (glm::int16)glm::packSnorm1x16(encoded.y));
+	surface.texCoords = glm::u16vec2(glm::packUnorm1x16(texCoords.x), glm::packUnorm1x16(texCoords.y));
+	return surface;
+}
+
+// attribute 0: position and cut flag, attribute 1: encoded normal, attribute 2: texture coordinates.
+// positionBuffer and surfaceBuffer hold the two streams; the vertex array must be bound.
+// ------------------------------------------------------------------------
+inline void setupStockAttributes(GLuint positionBuffer, GLuint surfaceBuffer)
+{
+	glState().bindBuffer(GL_ARRAY_BUFFER, positionBuffer);
+	glVertexAttribPointer(0, 4, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(StockPosition), (void*)0);
+	glEnableVertexAttribArray(0);
+	glState().bindBuffer(GL_ARRAY_BUFFER, surfaceBuffer);
+	glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(StockSurface), (void*)0);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(2, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(StockSurface), (void*)offsetof(StockSurface, texCoords));
+	glEnableVertexAttribArray(2);
+}
+#endif
@@ -0,0 +1,174 @@
+#ifndef STREAM_BUFFER_H
+#define STREAM_BUFFER_H
+
+#include <glad/glad.h>
+
+#include "gl_extensions.h"
+#include "gl_state.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+using namespace std;
+
+// Ring buffer for the data the CPU writes every frame, so uploads never wait for the GPU to finish with a
+// buffer it may still be reading. The ring is split into segments, one per frame in flight; a frame writes
+// into its own segment (moving on early if it writes more than a segment) and endFrame() puts a fence
+// behind it. A segment is only written again after its fence has signalled, which with three segments
+// normally has happened long before.
+//
+// With ARB_buffer_storage the ring is mapped once, persistently and coherently, and a write is a memcpy.
+// Without it every write maps its range unsynchronized, and instead of waiting for fences the buffer is
+// orphaned whenever the ring wraps, so the driver hands out fresh storage while the GPU finishes with the
+// old one.
+//
+// Data written is valid for the commands issued before the next write() or upload(): draw it right away,
+// or have upload() copy it into a buffer of its own. GL thread only.
+class StreamBuffer
+{
+public:
+	// segmentCount segments of segmentSize bytes; no single write may be larger than a segment
+	StreamBuffer(GLsizeiptr segmentSize, unsigned int segmentCount = 3, bool allowPersistent = true)
+		: segmentSize(segmentSize), segmentCount(segmentCount), mapped(NULL), segment(0), head(0), fences(segmentCount, (GLsync)0),
+		stalls(0), bytes(0), frames(0)
+	{
+		glGenBuffers(1, &buffer);
+		glState().bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		GLsizeiptr size = segmentSize * segmentCount;
+		if (allowPersistent && glExtensions().bufferStorage)
+		{
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glExtensions().BufferStorage(GL_COPY_WRITE_BUFFER, size, NULL, flags);
+			mapped = (unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags);
+		}
+		if (!mapped)
+			glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STREAM_DRAW);
+	}
+
+	~StreamBuffer()
+	{
+		for (unsigned int i = 0; i < segmentCount; i++)
+			if (fences[i])
+				glDeleteSync(fences[i]);
+		if (mapped)
+		{
+			glState().bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+			glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+		}
+		glState().deleteBuffers(1, &buffer);
+	}
+
+	StreamBuffer(const StreamBuffer&) = delete;
+	StreamBuffer& operator=(const StreamBuffer&) = delete;
+
+	// copies size bytes into the ring and returns their offset in id(), a multiple of alignment
+	// ------------------------------------------------------------------------
+	GLintptr write(const void *data, GLsizeiptr size, GLsizeiptr alignment = 16)
+	{
+		GLintptr offset = allocate(size, alignment);
+		if (mapped)
+			memcpy(mapped + offset, data, size);
+		else
+		{
+			glState().bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+			GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+			void *range = glMapBufferRange(GL_COPY_WRITE_BUFFER, offset, size, access);
+			if (range)
+			{
+				memcpy(range, data, size);
+				glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+			}
+		}
+		bytes += size;
+		return offset;
+	}
+
+	// size bytes into target at offset, through the ring and a copy on the GPU, so the CPU never waits
+	// for draws still reading target
+	// ------------------------------------------------------------------------
+	void upload(GLuint target, GLintptr offset, const void *data, GLsizeiptr size)
+	{
+		const unsigned char *next = (const unsigned char*)data;
+		while (size > 0)
+		{
+			GLsizeiptr piece = size < segmentSize ? size : segmentSize;
+			GLintptr source = write(next, piece, 4);
+			glState().bindBuffer(GL_COPY_READ_BUFFER, buffer);
+			glState().bindBuffer(GL_COPY_WRITE_BUFFER, target);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, source, offset, piece);
+			next += piece;
+			offset += piece;
+			size -= piece;
+		}
+	}
+
+	// fences what the frame wrote and moves a persistent ring to the next segment
+	// ------------------------------------------------------------------------
+	void endFrame()
+	{
+		frames++;
+		if (mapped)
+			nextSegment();
+	}
+
+	GLuint id() const { return buffer; }
+	bool persistent() const { return mapped != NULL; }
+
+	// statistics
+	// ------------------------------------------------------------------------
+	// times the CPU had to wait for the GPU before writing a segment again
+	unsigned long long stallCount() const { return stalls; }
+	double bytesPerFrame() const { return frames > 0 ? (double)bytes / frames : 0.0; }
+
+private:
+	GLuint buffer;
+	GLsizeiptr segmentSize;
+	unsigned int segmentCount;
+	unsigned char *mapped;	// the persistent mapping, NULL when orphaning
+	unsigned int segment;	// the segment being written
+	GLsizeiptr head;	// next free byte in it
+	vector<GLsync> fences;	// one per segment, 0 once waited for
+	unsigned long long stalls;
+	uint64_t bytes, frames;
+
+	GLintptr allocate(GLsizeiptr size, GLsizeiptr alignment)
+	{
+		head = (head + alignment - 1) / alignment * alignment;
+		if (head + size > segmentSize)
+			nextSegment();
+		GLintptr offset = segment * segmentSize + head;
+		head += size;
+		return offset;
+	}
+
+	void nextSegment()
+	{
+		if (mapped)
+		{
+			if (fences[segment])
+				glDeleteSync(fences[segment]);
+			fences[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		}
+		segment = (segment + 1) % segmentCount;
+		head = 0;
+		if (mapped && fences[segment])
+		{
+			// the first wait flushes, so the fence is sure to be reached
+			GLenum status = glClientWaitSync(fences[segment], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+			if (status == GL_TIMEOUT_EXPIRED)
+			{
+				stalls++;
+				while (status == GL_TIMEOUT_EXPIRED)
+					status = glClientWaitSync(fences[segment], 0, 1000000);
+			}
+			glDeleteSync(fences[segment]);
+			fences[segment] = 0;
+		}
+		else if (!mapped && segment == 0)
+		{
+			glState().bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+			glBufferData(GL_COPY_WRITE_BUFFER, segmentSize * segmentCount, NULL, GL_STREAM_DRAW);
+		}
+	}
+};
+#endif
@@ -0,0 +1,200 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <glad/glad.h>
+
+#include "baked_texture.h"
+#include "cache_file.h"
+#include "gl_state.h"
+
+#include <cctype>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// Process wide cache of the textures models load, so an image that several models (or meshes) refer to
+// is decoded and uploaded once. Textures are keyed by canonical path and load settings; an image that is
+// reached through a different path is still found by the content hash of its source file. Every acquire()
+// or insert() takes a reference, release() drops it, and the texture is deleted with its last reference.
+//
+// Lookups are hash map hits. contains() may be called from worker threads (to skip decoding what is
+// already loaded); everything else creates or deletes textures and belongs on the GL thread.
+class TextureCache
+{
+public:
+	static TextureCache& instance()
+	{
+		static TextureCache cache;
+		return cache;
+	}
+
+	TextureCache(const TextureCache&) = delete;
+	TextureCache& operator=(const TextureCache&) = delete;
+
+	// resolves ".", ".." and backslashes, and case on Windows, so one file always has one key
+	// ------------------------------------------------------------------------
+	static string canonicalPath(const string &path)
+	{
+		string normalized = path;
+		for (unsigned int i = 0; i < normalized.size(); i++)
+		{
+			if (normalized[i] == '\\')
+				normalized[i] = '/';
+#ifdef _WIN32
+			normalized[i] = (char)tolower((unsigned char)normalized[i]);
+#endif
+		}
+		vector<string> parts;
+		size_t start = 0;
+		while (start <= normalized.size())
+		{
+			size_t end = normalized.find('/', start);
+			if (end == string::npos)
+				end = normalized.size();
+			string part = normalized.substr(start, end - start);
+			if (part == ".." && !parts.empty() && parts.back() != ".." && !parts.back().empty())
+				parts.pop_back();
+			else if (part != "." && (!part.empty() || parts.empty()))
+				parts.push_back(part);
+			start = end + 1;
+		}
+		string result;
+		for (unsigned int i = 0; i < parts.size(); i++)
+			result += (i > 0 ? "/" : "") + parts[i];
+		return result;
+	}
+
+	// true if the texture for path is loaded; safe on any thread
+	bool contains(const string &path, bool flip, bool compressed) const
+	{
+		lock_guard<mutex> lock(guard);
+		return byPath.find(pathKey(path, flip, compressed)) != byPath.end();
+	}
+
+	// the texture for path with a new reference, or 0 if it isn't loaded yet
+	// ------------------------------------------------------------------------
+	unsigned int acquire(const string &path, bool flip, bool compressed)
+	{
+		lock_guard<mutex> lock(guard);
+		lookups++;
+		unordered_map<string, unsigned int>::iterator it = byPath.find(pathKey(path, flip, compressed));
+		if (it == byPath.end())
+			return 0;
+		hits++;
+		entries[it->second].references++;
+		return it->second;
+	}
+
+	// the texture for an image decoded from path, with a new reference. If an image with the same content
+	// and settings is loaded already that one is shared, otherwise image is uploaded. Called after acquire()
+	// missed, so it counts no lookup of its own; sharing a loaded texture turns that miss into a hit.
+	// ------------------------------------------------------------------------
+	unsigned int insert(const string &path, bool flip, bool compressed, const TextureImage &image)
+	{
+		string key = pathKey(path, flip, compressed);
+		{
+			lock_guard<mutex> lock(guard);
+			unordered_map<string, unsigned int>::iterator it = byPath.find(key);
+			if (it == byPath.end() && image.sourceHash != 0)
+			{
+				unordered_map<uint64_t, unsigned int>::iterator same = byContent.find(contentKey(image, flip));
+				if (same != byContent.end())
+				{
+					// another path to an image that is already loaded
+					byPath[key] = same->second;
+					entries[same->second].keys.push_back(key);
+					it = byPath.find(key);
+				}
+			}
+			if (it != byPath.end())
+			{
+				hits++;
+				entries[it->second].references++;
+				return it->second;
+			}
+		}
+
+		unsigned int textureID = uploadTextureImage(image);
+		lock_guard<mutex> lock(guard);
+		Entry &entry = entries[textureID];
+		entry.references = 1;
+		entry.keys.push_back(key);
+		byPath[key] = textureID;
+		if (image.sourceHash != 0)
+		{
+			entry.content = contentKey(image, flip);
+			entry.hasContent = true;
+			byContent[entry.content] = textureID;
+		}
+		return textureID;
+	}
+
+	// drops a reference, deleting the texture with the last one
+	// ------------------------------------------------------------------------
+	void release(unsigned int textureID)
+	{
+		lock_guard<mutex> lock(guard);
+		unordered_map<unsigned int, Entry>::iterator it = entries.find(textureID);
+		if (it == entries.end() || --it->second.references > 0)
+			return;
+		for (unsigned int i = 0; i < it->second.keys.size(); i++)
+			byPath.erase(it->second.keys[i]);
+		if (it->second.hasContent)
+			byContent.erase(it->second.content);
+		entries.erase(it);
+		glState().deleteTextures(1, &textureID);
+	}
+
+	unsigned int size() const
+	{
+		lock_guard<mutex> lock(guard);
+		return (unsigned int)entries.size();
+	}
+
+	// share of acquire() calls whose texture was loaded already, found by path or, in the insert() that
+	// followed a miss, by content
+	double hitRate() const
+	{
+		lock_guard<mutex> lock(guard);
+		return lookups > 0 ? (double)hits / lookups : 0.0;
+	}
+
+	unsigned long long lookupCount() const
+	{
+		lock_guard<mutex> lock(guard);
+		return lookups;
+	}
+
+private:
+	struct Entry {
+		unsigned int references;
+		vector<string> keys;	// every path key pointing at the texture
+		uint64_t content;
+		bool hasContent;
+
+		Entry() : references(0), content(0), hasContent(false) {}
+	};
+
+	mutable mutex guard;
+	unordered_map<string, unsigned int> byPath;
+	unordered_map<uint64_t, unsigned int> byContent;
+	unordered_map<unsigned int, Entry> entries;
+	unsigned long long lookups;
+	unsigned long long hits;
+
+	TextureCache() : lookups(0), hits(0) {}
+
+	static string pathKey(const string &path, bool flip, bool compressed)
+	{
+		return canonicalPath(path) + (flip ? "|flip" : "|") + (compressed ? "|bc" : "|");
+	}
+
+	static uint64_t contentKey(const TextureImage &image, bool flip)
+	{
+		uint64_t settings[2] = { flip ? 1u : 0u, image.format };
+		return hashBytes(settings, sizeof(settings), image.sourceHash);
+	}
+};
+#endif
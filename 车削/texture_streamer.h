@@ -0,0 +1,375 @@
+#ifndef TEXTURE_STREAMER_H
+#define TEXTURE_STREAMER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_precision.hpp>
+
+#include "baked_texture.h"
+#include "thread_pool.h"
+#include "gl_state.h"
+
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <string>
+using namespace std;
+
+// Streams textures in after the first frame instead of blocking startup on them. A request hands out a
+// shared 1x1 placeholder straight away and queues the decode on the worker pool; update(), called once
+// per frame on the GL thread, uploads finished images through a pixel buffer object in row bands until
+// the frame's time budget is spent. The real texture replaces the placeholder in the caller's slot only
+// once all of its mip levels are in, so a half uploaded image is never sampled. A band that can't go
+// through the pixel buffer is retried on the next frames; after MAX_BAND_RETRIES failures the texture is
+// given up and logged, and the slot keeps its placeholder.
+//
+// Each request is tagged with a ticket stored per slot. release() or a newer request for the same slot
+// replaces the ticket, and stale decodes/uploads are dropped when they come back.
+//
+// With compressedTextures set, request() takes the transcoded container of an image when there is one
+// and uploads its blocks as they are.
+//
+// requestLayer() streams into one layer of a texture array owned by the caller instead; the slot then
+// only serves as the ticket's key and isn't written.
+class TextureStreamer
+{
+public:
+	// size of one PBO upload; big enough to keep the driver busy, small enough to respect the budget
+	static const size_t BAND_BYTES = 4 << 20;
+	// frames a band whose buffer couldn't be mapped, or lost its data on unmap, is tried again
+	static const unsigned int MAX_BAND_RETRIES = 3;
+
+	explicit TextureStreamer(ThreadPool &pool, bool compressedTextures = false)
+		: pool(pool), compressed(compressedTextures), pbo(0), decoding(0), nextTicket(0)
+	{
+	}
+
+	~TextureStreamer()
+	{
+		// the workers still hold a pointer to the queue, wait for the decodes in flight
+		for (; decoding > 0; decoding--)
+			decoded.pop();
+		for (map<unsigned int, unsigned int>::iterator it = placeholders.begin(); it != placeholders.end(); ++it)
+			glState().deleteTextures(1, &it->second);
+		for (unsigned int i = 0; i < uploads.size(); i++)
+			if (uploads[i].target == GL_TEXTURE_2D)
+				glState().deleteTextures(1, &uploads[i].texture);
+		for (map<unsigned int, size_t>::iterator it = textureBytes.begin(); it != textureBytes.end(); ++it)
+			glState().deleteTextures(1, &it->first);
+		if (pbo != 0)
+			glState().deleteBuffers(1, &pbo);
+	}
+
+	TextureStreamer(const TextureStreamer&) = delete;
+	TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+	// *slot holds a placeholder of the given colour until the texture at path is fully uploaded.
+	// slot has to stay valid until then.
+	// ------------------------------------------------------------------------
+	void request(unsigned int *slot, const string &path, bool flip, glm::u8vec4 placeholderColor)
+	{
+		release(slot, placeholderColor);
+		unsigned int ticket = ++nextTicket;
+		tickets[slot] = ticket;
+		decoding++;
+		CompletionQueue<Upload> *target = &decoded;
+		bool compressed = this->compressed;
+		pool.enqueue([target, slot, ticket, path, flip, compressed] {
+			Upload upload;
+			upload.slot = slot;
+			upload.ticket = ticket;
+			upload.image = loadTextureImage(path, flip, compressed);
+			target->push(std::move(upload));
+		});
+	}
+
+	// uploads the image decode() returns (on a worker) into layer of arrayTexture, a GL_TEXTURE_2D_ARRAY
+	// with the same size and number of levels. pending(slot) is true until every level is in.
+	// ------------------------------------------------------------------------
+	void requestLayer(unsigned int *slot, unsigned int arrayTexture, unsigned int layer, function<TextureImage()> decode)
+	{
+		cancel(slot);
+		unsigned int ticket = ++nextTicket;
+		tickets[slot] = ticket;
+		decoding++;
+		CompletionQueue<Upload> *target = &decoded;
+		pool.enqueue([target, slot, ticket, arrayTexture, layer, decode] {
+			Upload upload;
+			upload.slot = slot;
+			upload.ticket = ticket;
+			upload.target = GL_TEXTURE_2D_ARRAY;
+			upload.texture = arrayTexture;
+			upload.layer = layer;
+			upload.image = decode();
+			target->push(std::move(upload));
+		});
+	}
+
+	// a shared 1x1 texture of one colour, created on first use
+	// ------------------------------------------------------------------------
+	unsigned int placeholder(glm::u8vec4 color)
+	{
+		unsigned int key = color.r | (color.g << 8) | (color.b << 16) | ((unsigned int)color.a << 24);
+		map<unsigned int, unsigned int>::iterator it = placeholders.find(key);
+		if (it != placeholders.end())
+			return it->second;
+
+		unsigned int textureID;
+		glGenTextures(1, &textureID);
+		glState().bindTexture(GL_TEXTURE_2D, textureID);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, &color[0]);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		placeholders[key] = textureID;
+		return textureID;
+	}
+
+	// deletes the streamed texture in *slot (or cancels it if it's still on its way) and puts a
+	// placeholder back
+	// ------------------------------------------------------------------------
+	void release(unsigned int *slot, glm::u8vec4 placeholderColor)
+	{
+		cancel(slot);
+		map<unsigned int, size_t>::iterator it = textureBytes.find(*slot);
+		if (it != textureBytes.end())
+		{
+			textureBytes.erase(it);
+			glState().deleteTextures(1, slot);
+		}
+		*slot = placeholder(placeholderColor);
+	}
+
+	// forgets the outstanding request for slot, whatever arrives for it later is dropped
+	void cancel(unsigned int *slot)
+	{
+		tickets.erase(slot);
+	}
+
+	// true while the texture for slot is still decoding or uploading
+	bool pending(unsigned int *slot) const
+	{
+		return tickets.find(slot) != tickets.end();
+	}
+
+	// estimated GPU memory of a texture created by the streamer (all levels), 0 for anything else
+	size_t bytes(unsigned int textureID) const
+	{
+		map<unsigned int, size_t>::const_iterator it = textureBytes.find(textureID);
+		return it != textureBytes.end() ? it->second : 0;
+	}
+
+	bool isPlaceholder(unsigned int textureID) const
+	{
+		for (map<unsigned int, unsigned int>::const_iterator it = placeholders.begin(); it != placeholders.end(); ++it)
+			if (it->second == textureID)
+				return true;
+		return false;
+	}
+
+	// uploads decoded images until budgetSeconds have passed; call once per frame
+	// ------------------------------------------------------------------------
+	void update(double budgetSeconds)
+	{
+		Upload upload;
+		while (decoded.tryPop(upload))
+		{
+			decoding--;
+			if (!isCurrent(upload))
+				continue;
+			if (upload.image.valid())
+				uploads.push_back(std::move(upload));
+			else
+			{
+				cout << "Texture failed to load at path: " << upload.image.path << endl;
+				tickets.erase(upload.slot);
+			}
+		}
+		dropStaleUploads();
+		if (uploads.empty())
+			return;
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		if (pbo == 0)
+			glGenBuffers(1, &pbo);
+		glState().bindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		// always make progress on at least one band, even if the budget is tiny
+		do
+		{
+			if (!uploadBand(uploads.front()))
+			{
+				// the band stays where it was: retried next frame, or given up on with the placeholder kept
+				Upload &failed = uploads.front();
+				if (++failed.failures < MAX_BAND_RETRIES)
+				{
+					cout << "Texture upload failed, retrying next frame: " << failed.image.path << endl;
+					break;
+				}
+				cout << "Texture failed to upload: " << failed.image.path << endl;
+				if (failed.target == GL_TEXTURE_2D && failed.texture != 0)
+					glState().deleteTextures(1, &failed.texture);
+				tickets.erase(failed.slot);
+				uploads.pop_front();
+				continue;
+			}
+			if (uploads.front().level == uploads.front().image.levels.size())
+			{
+				finish(uploads.front());
+				uploads.pop_front();
+			}
+			dropStaleUploads();
+		} while (!uploads.empty() && chrono::duration<double>(chrono::steady_clock::now() - start).count() < budgetSeconds);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		// leaving the PBO bound would turn every later glTexImage2D pointer into a buffer offset
+		glState().bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+
+	// true while anything is still decoding or waiting to be uploaded
+	bool busy() const
+	{
+		return decoding > 0 || !uploads.empty();
+	}
+
+private:
+	struct Upload {
+		unsigned int *slot;
+		unsigned int ticket;
+		TextureImage image;
+		GLenum target;		// GL_TEXTURE_2D: texture is ours until finish(), GL_TEXTURE_2D_ARRAY: the caller's
+		unsigned int texture;
+		unsigned int layer;
+		unsigned int level;
+		unsigned int row;
+		unsigned int failures;	// bands that didn't make it, see MAX_BAND_RETRIES
+
+		Upload() : slot(NULL), ticket(0), target(GL_TEXTURE_2D), texture(0), layer(0), level(0), row(0), failures(0) {}
+	};
+
+	ThreadPool &pool;
+	bool compressed;
+	CompletionQueue<Upload> decoded;
+	deque<Upload> uploads;
+	map<unsigned int, unsigned int> placeholders;	// packed rgba -> texture
+	map<unsigned int*, unsigned int> tickets;	// slot -> ticket of its outstanding request
+	map<unsigned int, size_t> textureBytes;		// streamed texture -> estimated size
+	unsigned int pbo;
+	unsigned int decoding;
+	unsigned int nextTicket;
+
+	bool isCurrent(const Upload &upload) const
+	{
+		map<unsigned int*, unsigned int>::const_iterator it = tickets.find(upload.slot);
+		return it != tickets.end() && it->second == upload.ticket;
+	}
+
+	// throws away uploads whose slot was released or re-requested since
+	void dropStaleUploads()
+	{
+		for (deque<Upload>::iterator it = uploads.begin(); it != uploads.end();)
+		{
+			if (isCurrent(*it))
+				++it;
+			else
+			{
+				if (it->target == GL_TEXTURE_2D && it->texture != 0)
+					glState().deleteTextures(1, &it->texture);
+				it = uploads.erase(it);
+			}
+		}
+	}
+
+	static GLenum formatOf(const TextureImage &image)
+	{
+		if (image.components == 1)
+			return GL_RED;
+		else if (image.components == 2)
+			return GL_RG;
+		else if (image.components == 3)
+			return GL_RGB;
+		return GL_RGBA;
+	}
+
+	// uploads the next band and moves past it; false if the pixel buffer couldn't be mapped or its data
+	// was lost on unmap, in which case nothing moves
+	bool uploadBand(Upload &upload)
+	{
+		const TextureImage &image = upload.image;
+		GLenum format = formatOf(image);
+		if (upload.target == GL_TEXTURE_2D_ARRAY)
+			glState().bindTexture(GL_TEXTURE_2D_ARRAY, upload.texture);
+		else if (upload.texture == 0)
+		{
+			// allocate every level first; the texture isn't visible to anyone until finish()
+			glGenTextures(1, &upload.texture);
+			glState().bindTexture(GL_TEXTURE_2D, upload.texture);
+			for (unsigned int i = 0; i < image.levels.size(); i++)
+			{
+				if (image.format != 0)
+					glCompressedTexImage2D(GL_TEXTURE_2D, i, image.format, image.levels[i].width, image.levels[i].height, 0, (GLsizei)image.levels[i].size, NULL);
+				else
+					glTexImage2D(GL_TEXTURE_2D, i, format, image.levels[i].width, image.levels[i].height, 0, format, GL_UNSIGNED_BYTE, NULL);
+			}
+		}
+		else
+			glState().bindTexture(GL_TEXTURE_2D, upload.texture);
+
+		// compressed levels go in whole rows of 4x4 blocks, so rowBytes and rowHeight cover one block row
+		const BakedTextureLevel &level = image.levels[upload.level];
+		unsigned int rowHeight = image.format != 0 ? 4 : 1;
+		size_t rowBytes = image.format != 0 ? (size_t)compressedLevelBytes(image.format, level.width, 1) : (size_t)level.width * image.components;
+		unsigned int rows = (unsigned int)std::max<size_t>(1, BAND_BYTES / rowBytes) * rowHeight;
+		rows = std::min(rows, level.height - upload.row);
+		size_t bytes = rowBytes * ((rows + rowHeight - 1) / rowHeight);
+
+		// orphan the previous band so the driver never has to wait for it
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+		void *dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		if (!dst)
+			return false;
+		memcpy(dst, image.levelData(upload.level) + rowBytes * (upload.row / rowHeight), bytes);
+		// GL_FALSE: the buffer's contents were lost while mapped (e.g. a mode switch)
+		if (glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_FALSE)
+			return false;
+		if (image.format != 0 && upload.target == GL_TEXTURE_2D_ARRAY)
+			glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, upload.level, 0, upload.row, upload.layer, level.width, rows, 1, image.format, (GLsizei)bytes, (void*)0);
+		else if (image.format != 0)
+			glCompressedTexSubImage2D(GL_TEXTURE_2D, upload.level, 0, upload.row, level.width, rows, image.format, (GLsizei)bytes, (void*)0);
+		else if (upload.target == GL_TEXTURE_2D_ARRAY)
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, upload.level, 0, upload.row, upload.layer, level.width, rows, 1, format, GL_UNSIGNED_BYTE, (void*)0);
+		else
+			glTexSubImage2D(GL_TEXTURE_2D, upload.level, 0, upload.row, level.width, rows, format, GL_UNSIGNED_BYTE, (void*)0);
+
+		upload.row += rows;
+		if (upload.row == level.height)
+		{
+			upload.level++;
+			upload.row = 0;
+		}
+		return true;
+	}
+
+	void finish(Upload &upload)
+	{
+		if (upload.target == GL_TEXTURE_2D_ARRAY)
+		{
+			tickets.erase(upload.slot);
+			return;
+		}
+		glState().bindTexture(GL_TEXTURE_2D, upload.texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)upload.image.levels.size() - 1);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		size_t total = 0;
+		for (unsigned int i = 0; i < upload.image.levels.size(); i++)
+			total += (size_t)upload.image.levels[i].size;
+		textureBytes[upload.texture] = total;
+		tickets.erase(upload.slot);
+		*upload.slot = upload.texture;
+		upload.texture = 0;
+	}
+};
+#endif
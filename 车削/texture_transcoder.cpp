@@ -0,0 +1,135 @@
+// Offline texture transcoder, built as its own target (transcoder.vcxproj).
+//
+// Bakes every image the viewer loads directly and writes a block compressed container for it next to the
+// plain one in cache/textures: images under resources/textures are loaded flipped, the model textures under
+// resources/models as they are. The PBR sets are skipped, they are resampled into texture arrays at load time
+// and compressed there. Run it from the project directory after installing or updating resources; the viewer
+// picks the compressed containers up when the context supports them and falls back to the plain ones
+// otherwise.
+
+#include "baked_texture.h"
+#include "block_compression.h"
+#include "thread_pool.h"
+
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+using namespace std;
+
+static bool isImage(const string &file)
+{
+	size_t dot = file.find_last_of('.');
+	if (dot == string::npos)
+		return false;
+	string extension = file.substr(dot + 1);
+	for (unsigned int i = 0; i < extension.size(); i++)
+		extension[i] = (char)tolower(extension[i]);
+	return extension == "png" || extension == "jpg" || extension == "jpeg" || extension == "bmp" || extension == "tga";
+}
+
+// every image below directory, except in subdirectories named skip
+static void listImages(const string &directory, const string &skip, vector<string> &files)
+{
+#ifdef _WIN32
+	WIN32_FIND_DATAA entry;
+	HANDLE find = FindFirstFileA((directory + "/*").c_str(), &entry);
+	if (find == INVALID_HANDLE_VALUE)
+		return;
+	do
+	{
+		string name = entry.cFileName;
+		bool isDirectory = (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+#else
+	DIR *dir = opendir(directory.c_str());
+	if (!dir)
+		return;
+	while (dirent *entry = readdir(dir))
+	{
+		string name = entry->d_name;
+		struct stat info;
+		bool isDirectory = stat((directory + "/" + name).c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+#endif
+		if (name == "." || name == "..")
+			continue;
+		if (isDirectory)
+		{
+			if (name != skip)
+				listImages(directory + "/" + name, skip, files);
+		}
+		else if (isImage(name))
+			files.push_back(directory + "/" + name);
+#ifdef _WIN32
+	} while (FindNextFileA(find, &entry));
+	FindClose(find);
+#else
+	}
+	closedir(dir);
+#endif
+}
+
+int main()
+{
+	vector<pair<string, bool>> sources;
+	vector<string> files;
+	listImages("resources/textures", "pbr", files);
+	for (unsigned int i = 0; i < files.size(); i++)
+		sources.push_back(make_pair(files[i], true));
+	files.clear();
+	listImages("resources/models", "", files);
+	for (unsigned int i = 0; i < files.size(); i++)
+		sources.push_back(make_pair(files[i], false));
+	if (sources.empty())
+	{
+		cout << "No textures found, run the transcoder from the project directory" << endl;
+		return 1;
+	}
+
+	// returns the plain and compressed size of each image, 0 if it failed
+	ThreadPool pool;
+	vector<future<pair<uint64_t, uint64_t>>> results;
+	for (unsigned int i = 0; i < sources.size(); i++)
+	{
+		pair<string, bool> source = sources[i];
+		results.push_back(pool.enqueue([source] {
+			TextureImage image = loadTextureImage(source.first, source.second);
+			if (!image.valid())
+				return make_pair((uint64_t)0, (uint64_t)0);
+			TextureImage compressed = compressTextureImage(image, compressedFormatFor(image.components));
+			if (!writeBakedTexture(source.first, source.second, compressed))
+				return make_pair((uint64_t)0, (uint64_t)0);
+			uint64_t plain = 0, packed = 0;
+			for (unsigned int i = 0; i < image.levels.size(); i++)
+			{
+				plain += image.levels[i].size;
+				packed += compressed.levels[i].size;
+			}
+			return make_pair(plain, packed);
+		}));
+	}
+
+	int failed = 0;
+	uint64_t plainTotal = 0, packedTotal = 0;
+	for (unsigned int i = 0; i < results.size(); i++)
+	{
+		pair<uint64_t, uint64_t> sizes = results[i].get();
+		if (sizes.first == 0)
+		{
+			cout << "Failed to transcode: " << sources[i].first << endl;
+			failed++;
+			continue;
+		}
+		cout << sources[i].first << ": " << sizes.first / 1024 << " KB -> " << sizes.second / 1024 << " KB" << endl;
+		plainTotal += sizes.first;
+		packedTotal += sizes.second;
+	}
+	cout << "Transcoded " << results.size() - failed << " of " << results.size() << " textures, "
+		<< plainTotal / 1024 << " KB -> " << packedTotal / 1024 << " KB" << endl;
+	return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,134 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads that run queued jobs in FIFO order. Used for the CPU-only part of
+// asset loading (image decode, model import); anything that touches OpenGL must stay on the thread
+// that owns the context.
+class ThreadPool
+{
+public:
+	// constructor, 0 threads means one per hardware thread
+	// ------------------------------------------------------------------------
+	explicit ThreadPool(unsigned int threads = 0) : stopping(false)
+	{
+		if (threads == 0)
+			threads = std::thread::hardware_concurrency();
+		if (threads == 0)
+			threads = 1;
+		for (unsigned int i = 0; i < threads; i++)
+			workers.emplace_back([this] { workerLoop(); });
+	}
+
+	// finishes the jobs that are already queued, then joins the workers
+	// ------------------------------------------------------------------------
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wakeup.notify_all();
+		for (unsigned int i = 0; i < workers.size(); i++)
+			workers[i].join();
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// queues a job and returns a future for its result
+	// ------------------------------------------------------------------------
+	template <typename F>
+	auto enqueue(F&& job) -> std::future<decltype(job())>
+	{
+		typedef decltype(job()) Result;
+		std::shared_ptr<std::packaged_task<Result()>> task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(job));
+		std::future<Result> result = task->get_future();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push_back([task] { (*task)(); });
+		}
+		wakeup.notify_one();
+		return result;
+	}
+
+	unsigned int size() const
+	{
+		return (unsigned int)workers.size();
+	}
+
+private:
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> jobs;
+	std::mutex mutex;
+	std::condition_variable wakeup;
+	bool stopping;
+
+	void workerLoop()
+	{
+		for (;;)
+		{
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wakeup.wait(lock, [this] { return stopping || !jobs.empty(); });
+				if (jobs.empty())
+					return;
+				job = std::move(jobs.front());
+				jobs.pop_front();
+			}
+			job();
+		}
+	}
+};
+
+// A thread-safe FIFO that workers push finished results into, so the consumer (usually the GL thread)
+// can handle them in completion order rather than submission order.
+template <typename T>
+class CompletionQueue
+{
+public:
+	void push(T value)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			items.push_back(std::move(value));
+		}
+		ready.notify_one();
+	}
+
+	// blocks until an item is available
+	T pop()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		ready.wait(lock, [this] { return !items.empty(); });
+		T value = std::move(items.front());
+		items.pop_front();
+		return value;
+	}
+
+	// returns false straight away if nothing has finished yet
+	bool tryPop(T &value)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (items.empty())
+			return false;
+		value = std::move(items.front());
+		items.pop_front();
+		return true;
+	}
+
+private:
+	std::deque<T> items;
+	std::mutex mutex;
+	std::condition_variable ready;
+};
+#endif
@@ -0,0 +1,91 @@
+#ifndef UNIFORM_BUFFER_H
+#define UNIFORM_BUFFER_H
+
+#include <glad/glad.h>
+#include "gl_state.h"
+
+// A uniform buffer holding one std140 struct T, attached to a fixed binding point for its whole life.
+// Programs pick it up once through Shader::bindUniformBlock, so however many programs read it, changing
+// the data is a single buffer upload. T must match the block's std140 layout (vec3 padded to vec4 etc.).
+template <typename T>
+class UniformBuffer
+{
+public:
+	explicit UniformBuffer(GLuint binding) : binding(binding)
+	{
+		glGenBuffers(1, &ubo);
+		glState().bindBuffer(GL_UNIFORM_BUFFER, ubo);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(T), NULL, GL_DYNAMIC_DRAW);
+		glState().bindBuffer(GL_UNIFORM_BUFFER, 0);
+		glBindBufferBase(GL_UNIFORM_BUFFER, binding, ubo);
+	}
+
+	~UniformBuffer()
+	{
+		glState().deleteBuffers(1, &ubo);
+	}
+
+	UniformBuffer(const UniformBuffer&) = delete;
+	UniformBuffer& operator=(const UniformBuffer&) = delete;
+
+	// replaces the whole block
+	void update(const T &data)
+	{
+		glState().bindBuffer(GL_UNIFORM_BUFFER, ubo);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(T), &data);
+		glState().bindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+	GLuint id() const { return ubo; }
+	GLuint bindingPoint() const { return binding; }
+
+private:
+	GLuint ubo;
+	GLuint binding;
+};
+
+// A uniform buffer holding count std140 structs T, one per draw (or instance), each at an offset the
+// context accepts for binding. set() writes one slot and attaches it to the binding point, so draws in the
+// same frame never overwrite each other's data and programs read the current draw's block through a
+// fixed binding.
+template <typename T>
+class UniformBufferArray
+{
+public:
+	UniformBufferArray(GLuint binding, unsigned int count) : binding(binding), count(count)
+	{
+		GLint alignment = 256;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		stride = ((GLsizeiptr)sizeof(T) + alignment - 1) / alignment * alignment;
+		glGenBuffers(1, &ubo);
+		glState().bindBuffer(GL_UNIFORM_BUFFER, ubo);
+		glBufferData(GL_UNIFORM_BUFFER, stride * count, NULL, GL_DYNAMIC_DRAW);
+		glState().bindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+	~UniformBufferArray()
+	{
+		glState().deleteBuffers(1, &ubo);
+	}
+
+	UniformBufferArray(const UniformBufferArray&) = delete;
+	UniformBufferArray& operator=(const UniformBufferArray&) = delete;
+
+	// uploads data into slot and makes it the block programs see at the binding point
+	void set(unsigned int slot, const T &data)
+	{
+		glState().bindBuffer(GL_UNIFORM_BUFFER, ubo);
+		glBufferSubData(GL_UNIFORM_BUFFER, slot * stride, sizeof(T), &data);
+		glState().bindBuffer(GL_UNIFORM_BUFFER, 0);
+		glBindBufferRange(GL_UNIFORM_BUFFER, binding, ubo, slot * stride, sizeof(T));
+	}
+
+	unsigned int size() const { return count; }
+
+private:
+	GLuint ubo;
+	GLuint binding;
+	unsigned int count;
+	GLsizeiptr stride;
+};
+#endif